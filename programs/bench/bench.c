@@ -0,0 +1,177 @@
+#include "peachos.h"
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+
+// Syscalls timed per batch, the fastest batch is reported
+#define SYSCALL_BENCH_CALLS 100
+#define SYSCALL_BENCH_BATCHES 20
+
+// Iterations are reported every SPIN_SAMPLE_CYCLES, SPIN_SAMPLES times
+#define SPIN_SAMPLE_CYCLES 0x40000000u
+#define SPIN_SAMPLES 3
+
+#define READ_CHUNK_SIZE 4096
+#define READ_SAMPLE_BYTES (256 * 1024)
+
+/* Queue a single request on the I/O ring and return its result */
+static int io_ring_run(struct io_ring *ring, unsigned int opcode, int fd, void *addr, unsigned int len)
+{
+    struct io_ring_sqe *sqe = &ring->sqes[ring->sq_tail % PEACHOS_IO_RING_ENTRIES];
+    struct io_ring_cqe *cqe;
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned int) addr;
+    sqe->len = len;
+    sqe->offset = IO_RING_OFFSET_CURRENT;
+    sqe->user_data = 0;
+    ring->sq_tail++;
+
+    if (peachos_io_ring_enter(1) != 1)
+        return -1;
+
+    cqe = &ring->cqes[ring->cq_head % PEACHOS_IO_RING_ENTRIES];
+    ring->cq_head++;
+    return cqe->res;
+}
+
+/*
+ * Cycles of a syscall that does almost no work, print() of an empty string.
+ * A batch interrupted by the timer switches tasks, only the fastest batch
+ * counts.
+ */
+static unsigned int syscall_cycles(void (*syscall)(const char *message))
+{
+    unsigned int best = 0xFFFFFFFF;
+
+    for (int batch = 0; batch < SYSCALL_BENCH_BATCHES; batch++) {
+        unsigned int start = peachos_read_tsc();
+        unsigned int cycles;
+
+        for (int i = 0; i < SYSCALL_BENCH_CALLS; i++)
+            syscall("");
+
+        cycles = peachos_read_tsc() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return best / SYSCALL_BENCH_CALLS;
+}
+
+/*
+ * Arguments passed in registers against the stack, both through int 0x80,
+ * then sysenter if the processor has it.
+ */
+static void bench_syscall(void)
+{
+    unsigned int registers;
+    unsigned int stack;
+    unsigned int sysenter = 0;
+
+    peachos_syscall_set_sysenter(false);
+    registers = syscall_cycles(print);
+    stack = syscall_cycles(peachos_print_stack_arguments);
+
+    if (peachos_syscall_set_sysenter(true))
+        sysenter = syscall_cycles(print);
+
+    printf("bench: syscall %i cycles, %i with stack arguments, %i with sysenter\n",
+           registers, stack, sysenter);
+}
+
+/* Count loop iterations without a syscall, printing the count now and then */
+static void bench_spin(void)
+{
+    unsigned int iterations = 0;
+    unsigned int last = peachos_read_tsc();
+
+    for (int sample = 0; sample < SPIN_SAMPLES; iterations++) {
+        if (peachos_read_tsc() - last < SPIN_SAMPLE_CYCLES)
+            continue;
+
+        printf("spin: %i iterations\n", iterations);
+        last = peachos_read_tsc();
+        sample++;
+    }
+}
+
+/*
+ * Read the whole file a chunk at a time, printing the bytes read every
+ * READ_SAMPLE_BYTES. The task sleeps while the disk works for it. The disk
+ * commands and the head travel of the request queue while it read, the
+ * other readers included, are compared with serving the bios in arrival
+ * order.
+ */
+static void bench_read(const char *filename)
+{
+    static char buf[READ_CHUNK_SIZE];
+    struct bio_stat before;
+    struct bio_stat after;
+    struct io_ring *ring;
+    int total = 0;
+    int fd;
+    int res;
+
+    peachos_bio_stats(&before);
+
+    ring = peachos_io_ring_setup();
+    if ((int) ring <= 0)
+        return;
+
+    fd = io_ring_run(ring, IO_RING_OP_OPEN, 0, (void *) filename, 0);
+    if (fd <= 0) {
+        printf("read %s: open failed\n", filename);
+        return;
+    }
+
+    do {
+        res = io_ring_run(ring, IO_RING_OP_READ, fd, buf, sizeof(buf));
+        if (res > 0)
+            total += res;
+
+        if (res > 0 && (total % READ_SAMPLE_BYTES == 0 || res != sizeof(buf)))
+            printf("read %s: %i bytes\n", filename, total);
+    } while (res == sizeof(buf));
+
+    io_ring_run(ring, IO_RING_OP_CLOSE, fd, NULL, 0);
+
+    if (res < 0) {
+        printf("read %s: failed after %i bytes\n", filename, total);
+        return;
+    }
+
+    peachos_bio_stats(&after);
+    printf("read %s: %i commands seek %i, %i seek %i in arrival order\n",
+           filename, after.requests - before.requests, after.travel - before.travel,
+           after.bios - before.bios, after.arrival_travel - before.arrival_travel);
+}
+
+/*
+ * Measurements started by the kernel at boot, see kernel_main():
+ *
+ *   bench.elf syscall      cycles of a syscall round trip
+ *   bench.elf spin         CPU-bound loop, runs while the readers sleep
+ *   bench.elf read <file>  sequential read of a file
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        print("usage: bench.elf syscall | spin | read <file>\n");
+        return 0;
+    }
+
+    if (strncmp(argv[1], "syscall", 8) == 0)
+        bench_syscall();
+    else if (strncmp(argv[1], "spin", 5) == 0)
+        bench_spin();
+    else if (strncmp(argv[1], "read", 5) == 0 && argc > 2)
+        bench_read(argv[2]);
+
+    // Keep the results on the screen, it doesn't scroll. The syscalls let the
+    // kernel write the buffer cache back periodically.
+    while(1)
+        peachos_getkey();
+    return 0;
+}
@@ -2,7 +2,12 @@
 
 section .asm
 
+; Set along with the command in eax, the arguments are passed in
+; ebx, ecx, edx, esi and edi instead of the stack
+%define REGISTER_ARGUMENTS 0x80000000
+
 global print:function
+global peachos_print_stack_arguments:function
 global peachos_getkey:function
 global peachos_malloc:function
 global peachos_free:function
@@ -11,15 +16,100 @@ global peachos_process_load_start:function
 global peachos_process_get_arguments:function
 global peachos_system:function
 global peachos_exit:function
+global peachos_kmem_cache_stats:function
+global peachos_bcache_stats:function
+global peachos_io_ring_setup:function
+global peachos_io_ring_enter:function
+global peachos_sync:function
+global peachos_bio_stats:function
+global peachos_syscall_init:function
+global peachos_syscall_set_sysenter:function
+global peachos_read_tsc:function
+
+; void peachos_syscall_init(void)
+;
+; Use sysenter for the syscalls if the processor supports it
+peachos_syscall_init:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov eax, 1
+    cpuid
+    shr edx, 11             ; CPUID.01h:EDX bit 11, sysenter and sysexit
+    and edx, 1
+    mov [peachos_sysenter], edx
+    pop ebx
+    pop ebp
+    ret
+
+; int peachos_syscall_set_sysenter(int enable)
+;
+; Use sysenter, if the processor supports it, or int 0x80 for the syscalls.
+; Returns whether sysenter is used.
+peachos_syscall_set_sysenter:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov eax, 1
+    cpuid
+    shr edx, 11             ; CPUID.01h:EDX bit 11, sysenter and sysexit
+    and edx, 1
+    cmp dword [ebp+8], 0
+    jne .set
+    xor edx, edx
+.set:
+    mov [peachos_sysenter], edx
+    mov eax, edx
+    pop ebx
+    pop ebp
+    ret
+
+; unsigned int peachos_read_tsc(void)
+;
+; Low 32 bits of the time stamp counter
+peachos_read_tsc:
+    rdtsc
+    ret
+
+; Enter the kernel, eax holds the command and the registers the arguments.
+; ecx and edx are not preserved.
+peachos_syscall:
+    cmp dword [peachos_sysenter], 0
+    je .int80
+    push ebp
+    push .resume            ; The kernel returns to the address on top of the stack
+    mov ebp, esp            ; sysenter doesn't save the stack pointer
+    sysenter
+.resume:
+    pop ebp
+    ret
+.int80:
+    int 0x80
+    ret
 
 ; void print(const char *message)
 print:
     push ebp
     mov ebp, esp
-    push dword[ebp+8]
-    mov eax, 1      ; Command print
+    push ebx                ; Callee saved, used for the first argument
+    mov ebx, [ebp+8]        ; Variable "message"
+    mov eax, REGISTER_ARGUMENTS | 1     ; Command print
+    call peachos_syscall
+    pop ebx
+    pop ebp
+    ret
+
+; void peachos_print_stack_arguments(const char *message)
+;
+; print() through int 0x80 with the argument on the stack, the ABI kept for
+; programs built before the register arguments
+peachos_print_stack_arguments:
+    push ebp
+    mov ebp, esp
+    push dword [ebp+8]      ; Variable "message"
+    mov eax, 1              ; Command print
     int 0x80
-    add esp, 4      ; Restore the stack pointer
+    add esp, 4              ; Restore the stack pointer
     pop ebp
     ret
 
@@ -27,8 +117,8 @@ print:
 peachos_getkey:
     push ebp
     mov ebp, esp
-    mov eax, 2      ; Command getkey
-    int 0x80
+    mov eax, REGISTER_ARGUMENTS | 2     ; Command getkey
+    call peachos_syscall
     pop ebp
     ret
 
@@ -36,10 +126,11 @@ peachos_getkey:
 peachos_putchar:
     push ebp
     mov ebp, esp
-    mov eax, 3          ; Command putchar
-    push dword[ebp+8]   ; Variable "c"
-    int 0x80
-    add esp, 4
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "c"
+    mov eax, REGISTER_ARGUMENTS | 3     ; Command putchar
+    call peachos_syscall
+    pop ebx
     pop ebp
     ret
 
@@ -47,10 +138,11 @@ peachos_putchar:
 peachos_malloc:
     push ebp
     mov ebp, esp
-    mov eax, 4          ; Command malloc (allocates memory for the process)
-    push dword[ebp+8]   ; Push argument "size"
-    int 0x80
-    add esp, 4          ; Restore the stack (argument "size" pushed)
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "size"
+    mov eax, REGISTER_ARGUMENTS | 4     ; Command malloc (allocates memory for the process)
+    call peachos_syscall
+    pop ebx
     pop ebp
     ret
 
@@ -58,10 +150,11 @@ peachos_malloc:
 peachos_free:
     push ebp
     mov ebp, esp
-    mov eax, 5             ; Command free (frees the allocated memory for this process)
-    push dword[ebp+8]      ; Variable ptr
-    int 0x80
-    add esp, 4
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "ptr"
+    mov eax, REGISTER_ARGUMENTS | 5     ; Command free (frees the allocated memory for this process)
+    call peachos_syscall
+    pop ebx
     pop ebp
     ret
 
@@ -69,10 +162,11 @@ peachos_free:
 peachos_process_load_start:
     push ebp
     mov ebp, esp
-    mov eax, 6          ; Comand process load start (start a process)
-    push dword[ebp+8]    ; Variable "filename"
-    int 0x80
-    add esp, 4          ; We return to here only when the process is terminated
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "filename"
+    mov eax, REGISTER_ARGUMENTS | 6     ; Comand process load start (start a process)
+    call peachos_syscall
+    pop ebx                 ; We return to here only when the process is terminated
     pop ebp
     ret
 
@@ -80,10 +174,11 @@ peachos_process_load_start:
 peachos_system:
     push ebp
     mov ebp, esp
-    mov eax, 7          ; Command process system (runs a system command basd on the arguments)
-    push dword[ebp+8]   ; Variable "arguments"
-    int 0x80
-    add esp, 4
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "arguments"
+    mov eax, REGISTER_ARGUMENTS | 7     ; Command process system (runs a system command basd on the arguments)
+    call peachos_syscall
+    pop ebx
     pop ebp
     ret
 
@@ -91,10 +186,11 @@ peachos_system:
 peachos_process_get_arguments:
     push ebp
     mov ebp, esp
-    mov eax, 8          ; Command get the process arguments
-    push dword[ebp+8]   ; Variable "arguments"
-    int 0x80
-    add esp, 4
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "arguments"
+    mov eax, REGISTER_ARGUMENTS | 8     ; Command get the process arguments
+    call peachos_syscall
+    pop ebx
     pop ebp
     ret
 
@@ -102,7 +198,79 @@ peachos_process_get_arguments:
 peachos_exit:
     push ebp
     mov ebp, esp
-    mov eax, 9          ; Command exit
-    int 0x80
+    mov eax, REGISTER_ARGUMENTS | 9     ; Command exit
+    call peachos_syscall
+    pop ebp
+    ret
+
+; int peachos_kmem_cache_stats(struct kmem_cache_stat *stats, int max)
+peachos_kmem_cache_stats:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "stats"
+    mov ecx, [ebp+12]       ; Variable "max"
+    mov eax, REGISTER_ARGUMENTS | 10    ; Command kernel slab cache statistics
+    call peachos_syscall
+    pop ebx
+    pop ebp
+    ret
+
+; int peachos_bcache_stats(struct bcache_stat *stat)
+peachos_bcache_stats:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "stat"
+    mov eax, REGISTER_ARGUMENTS | 11    ; Command disk buffer cache statistics
+    call peachos_syscall
+    pop ebx
     pop ebp
-    ret
\ No newline at end of file
+    ret
+
+; struct io_ring *peachos_io_ring_setup(void)
+peachos_io_ring_setup:
+    push ebp
+    mov ebp, esp
+    mov eax, REGISTER_ARGUMENTS | 12    ; Command I/O ring setup
+    call peachos_syscall
+    pop ebp
+    ret
+
+; int peachos_io_ring_enter(unsigned int to_submit)
+peachos_io_ring_enter:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "to_submit"
+    mov eax, REGISTER_ARGUMENTS | 13    ; Command I/O ring enter
+    call peachos_syscall
+    pop ebx
+    pop ebp
+    ret
+
+; int peachos_sync(void)
+peachos_sync:
+    push ebp
+    mov ebp, esp
+    mov eax, REGISTER_ARGUMENTS | 14    ; Command sync
+    call peachos_syscall
+    pop ebp
+    ret
+
+; int peachos_bio_stats(struct bio_stat *stat)
+peachos_bio_stats:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov ebx, [ebp+8]        ; Variable "stat"
+    mov eax, REGISTER_ARGUMENTS | 15    ; Command disk request queue statistics
+    call peachos_syscall
+    pop ebx
+    pop ebp
+    ret
+
+
+section .data
+
+peachos_sysenter: dd 0
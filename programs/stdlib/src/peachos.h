@@ -14,7 +14,77 @@ struct process_arguments {
     char **argv;
 };
 
+struct kmem_cache_stat {
+    char name[20];
+    unsigned int object_size;
+    unsigned int objects_inuse;
+    unsigned int objects_total;
+    unsigned int slabs;
+    int bytes_saved;
+};
+
+struct bcache_stat {
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int evictions;
+    unsigned int buffers;
+    unsigned int max_buffers;
+    unsigned int prefetched;
+    unsigned int prefetch_used;
+    unsigned int prefetch_wasted;
+    unsigned int dirty;
+    unsigned int written;
+    unsigned int syncs;
+};
+
+struct bio_stat {
+    unsigned int bios;
+    unsigned int requests;
+    unsigned int travel;
+    unsigned int arrival_travel;
+};
+
+#define PEACHOS_IO_RING_ENTRIES 64
+
+#define IO_RING_OP_NOP 0
+#define IO_RING_OP_OPEN 1
+#define IO_RING_OP_READ 2
+#define IO_RING_OP_CLOSE 3
+
+// Read from the current position of the file
+#define IO_RING_OFFSET_CURRENT 0xFFFFFFFF
+
+struct io_ring_sqe {
+    unsigned int opcode;
+    int fd;                     // read, close
+    unsigned int addr;          // open: file name, read: buffer
+    unsigned int len;           // read: bytes
+    unsigned int offset;        // read: file position or IO_RING_OFFSET_CURRENT
+    unsigned int user_data;     // copied to the completion
+};
+
+struct io_ring_cqe {
+    unsigned int user_data;
+    int res;                    // open: fd, read: bytes read, or a negative error
+};
+
+/*
+ * Requests are queued at sq_tail and their completions reaped at cq_head,
+ * the kernel moves sq_head and cq_tail. The indexes only grow, index "i" is
+ * slot i % PEACHOS_IO_RING_ENTRIES.
+ */
+struct io_ring {
+    volatile unsigned int sq_head;
+    volatile unsigned int sq_tail;
+    volatile unsigned int cq_head;
+    volatile unsigned int cq_tail;
+
+    struct io_ring_sqe sqes[PEACHOS_IO_RING_ENTRIES];
+    struct io_ring_cqe cqes[PEACHOS_IO_RING_ENTRIES];
+};
+
 void print(const char *message);
+void peachos_print_stack_arguments(const char *message);
 int peachos_getkey(void);
 void *peachos_malloc(size_t size);
 void peachos_free(void *ptr);
@@ -27,5 +97,13 @@ void peachos_process_get_arguments(struct process_arguments *arguments);
 int peachos_system(struct command_argument *arguments);
 int peachos_system_run(const char *command);
 void peachos_exit();
+int peachos_kmem_cache_stats(struct kmem_cache_stat *stats, int max);
+int peachos_bcache_stats(struct bcache_stat *stat);
+struct io_ring *peachos_io_ring_setup(void);
+int peachos_io_ring_enter(unsigned int to_submit);
+int peachos_sync(void);
+int peachos_bio_stats(struct bio_stat *stat);
+int peachos_syscall_set_sysenter(int enable);
+unsigned int peachos_read_tsc(void);
 
 #endif // PEACHOS_H
\ No newline at end of file
@@ -4,9 +4,11 @@ section .asm
 
 global _start
 extern c_start
+extern peachos_syscall_init
 extern peachos_exit
 
 _start:
+    call peachos_syscall_init
     call c_start
     call peachos_exit
     ret
\ No newline at end of file
@@ -106,7 +106,7 @@ gdt_descriptor:
 [BITS 32]
 load32:
 	mov eax, 1		; LBA. 0 is the boot sector
-	mov ecx, 100		; total number of sectors to load
+	mov ecx, 199		; total number of sectors to load (all the reserved sectors)
 	mov edi, 0x0100000	; buffer target address (1M address)
 	call ata_lba_read
 	jmp CODE_SEG:0x0100000
@@ -12,31 +12,80 @@
 
 #define PEACHOS_TOTAL_INTERRUPTS 512
 
-/* 100MB heap size */
-#define PEACHOS_HEAP_SIZE_BYTES 104857600
+/* 32MB heap size, for kernel objects only */
+#define PEACHOS_HEAP_SIZE_BYTES 33554432
 #define PEACHOS_HEAP_BLOCK_SIZE 4096
 
  /* https://wiki.osdev.org/Memory_Map */
 #define PEACHOS_HEAP_ADDRESS 0X01000000
 #define PEACHOS_HEAP_TABLE_ADDRESS 0x00007E00
 
+/* Allocation start of each heap block, 2 bytes per block right after the table */
+#define PEACHOS_HEAP_STARTS_ADDRESS 0x00009E00
+
+/* 76MB of page frames for page tables and user pages, right after the heap */
+#define PEACHOS_FRAME_POOL_ADDRESS 0x03000000
+#define PEACHOS_FRAME_POOL_SIZE_BYTES 79691776
+
+/* kmalloc serves requests up to this size from power of two size classes */
+#define PEACHOS_KMALLOC_MIN_SIZE 16
+#define PEACHOS_KMALLOC_MAX_SIZE 2048
+
 #define PEACHOS_MAX_PATH 108
 
+/* Run the boot-time checks and measurements of kernel_main() */
+#define PEACHOS_SELFTEST 1
+
+/* Keep the kernel heap mapping in the TLB across CR3 reloads, 0 to measure without it */
+#define PEACHOS_PAGING_GLOBAL 1
+
+/*
+ * The check of the buffer cache writes to the disk: it writes and restores
+ * the scratch sector and leaves a boot counter in the next one. Both must be
+ * in a cluster the FAT marks free, near the end of the disk.
+ */
+#define PEACHOS_SELFTEST_WRITE 0
+#define PEACHOS_SELFTEST_SCRATCH_LBA 32000
+
+/* Maximum number of arguments passed to a program by the shell */
+#define PEACHOS_MAX_COMMAND_ARGUMENTS 16
+
 #define PEACHOS_SECTOR_SIZE 512
 
+/* Memory budget of the disk buffer cache, 1MB */
+#define PEACHOS_BCACHE_SIZE_BYTES 1048576
+
+/* Write-back of the buffer cache: ~5s at the default PIT rate of 18.2Hz, 256KB */
+#define PEACHOS_BCACHE_FLUSH_TICKS 91
+#define PEACHOS_BCACHE_DIRTY_MAX 512
+
+/* Read-ahead window of sequential disk streams, in sectors */
+#define PEACHOS_READAHEAD_MIN_SECTORS 4
+#define PEACHOS_READAHEAD_MAX_SECTORS 64
+
+/* Directory entries kept by the path lookup cache */
+#define PEACHOS_DCACHE_ENTRIES 256
+
 #define PEACHOS_MAX_FILESYSTEMS 12
 #define PEACHOS_MAX_FILE_DESCRIPTORS 512
 
+// Files a process can open through its I/O ring
+#define PEACHOS_MAX_PROCESS_FILES 32
+
+// Slots of the submission and completion rings
+#define PEACHOS_IO_RING_ENTRIES 64
+
 #define PEACHOS_TOTAL_GDT_SEGMENTS 6
 
 // Stack grows downwards in Intel
 #define PEACHOS_PROGRAM_VIRTUAL_ADDRESS 0x400000
 #define PEACHOS_USER_PROGRAM_STACK_SIZE 1024 * 16
+#define PEACHOS_TASK_KERNEL_STACK_SIZE 1024 * 16
 #define PEACHOS_PROGRAM_VIRTUAL_STACK_ADDRESS_START 0x3FF000
 #define PEACHOS_PROGRAM_VIRTUAL_STACK_ADDRESS_END PEACHOS_PROGRAM_VIRTUAL_STACK_ADDRESS_START - PEACHOS_USER_PROGRAM_STACK_SIZE
 
 #define PEACHOS_MAX_PROGRAM_ALLOCATIONS 1024
-#define PEACHOS_MAX_PROCESSES 12
+#define PEACHOS_MAX_PROCESSES 64
 
 #define USER_DATA_SEGMENT 0x23
 #define USER_CODE_SEGMENT 0x1b
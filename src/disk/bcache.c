@@ -0,0 +1,572 @@
+/*
+ * Disk buffer cache
+ *
+ * Sectors read from the disks are kept in memory, indexed by (disk, lba) in
+ * a hash table. Once PEACHOS_BCACHE_SIZE_BYTES worth of sectors are cached,
+ * the least recently used clean one is recycled.
+ *
+ * Writes only go to the cache. The dirty sectors are written back in
+ * batches, where the request queue merges the adjacent ones, followed by a
+ * disk cache flush: by bcache_sync(), after PEACHOS_BCACHE_FLUSH_TICKS and
+ * when PEACHOS_BCACHE_DIRTY_MAX sectors are dirty.
+ *
+ * Tasks don't hold any lock while reading the disk, so the cache can change
+ * under a read in progress. Sectors that were read before a write of the
+ * cache completed are not cached, they could be stale.
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#include "bcache.h"
+#include "bio.h"
+#include "disk.h"
+#include "kernel.h"
+#include "status.h"
+#include "memory/memory.h"
+#include "memory/slab/slab.h"
+#include "memory/frame/frame.h"
+#include "memory/heap/kheap.h"
+#include "idt/idt.h"
+#include "task/task.h"
+
+#define BCACHE_HASH_BUCKETS 256
+#define BCACHE_MAX_BUFFERS (PEACHOS_BCACHE_SIZE_BYTES / PEACHOS_SECTOR_SIZE)
+
+// Dirty sectors written back before waiting for them
+#define BCACHE_SYNC_BATCH 64
+
+static struct kmem_cache *bcache_buffer_cache;
+static struct bcache_buffer *bcache_hash[BCACHE_HASH_BUCKETS];
+
+static struct bcache_buffer *bcache_lru_head;
+static struct bcache_buffer *bcache_lru_tail;
+
+// Incremented by each write
+static uint32_t bcache_generation;
+
+static struct bcache_stat bcache_stats;
+
+// A read-ahead in the request queue
+struct bcache_prefetch {
+    struct bio bio;
+    void *buffer;
+    uint32_t generation;
+};
+
+static struct kmem_cache *bcache_prefetch_cache;
+
+// One sync at a time, a second one waits for the sectors to be on the disk
+static struct task_lock bcache_sync_lock;
+static uint32_t bcache_last_sync;
+
+// Written since the last disk cache flush, NULL if none
+static struct disk *bcache_unflushed_disk;
+
+void bcache_init(void)
+{
+    bcache_buffer_cache = kmem_cache_create("bcache_buffer", sizeof(struct bcache_buffer), NULL);
+    if (!bcache_buffer_cache)
+        panic("Failed to create the buffer cache\n");
+
+    bcache_prefetch_cache = kmem_cache_create("bcache_prefetch", sizeof(struct bcache_prefetch), NULL);
+    if (!bcache_prefetch_cache)
+        panic("Failed to create the read-ahead cache\n");
+
+    bcache_stats.max_buffers = BCACHE_MAX_BUFFERS;
+}
+
+static uint32_t bcache_hash_index(struct disk *disk, uint32_t lba)
+{
+    return (lba ^ (disk->id * 0x9E3779B1)) % BCACHE_HASH_BUCKETS;
+}
+
+static void bcache_lru_remove(struct bcache_buffer *buffer)
+{
+    if (buffer->lru_prev)
+        buffer->lru_prev->lru_next = buffer->lru_next;
+    else
+        bcache_lru_head = buffer->lru_next;
+
+    if (buffer->lru_next)
+        buffer->lru_next->lru_prev = buffer->lru_prev;
+    else
+        bcache_lru_tail = buffer->lru_prev;
+
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+}
+
+static void bcache_lru_insert_head(struct bcache_buffer *buffer)
+{
+    buffer->lru_prev = NULL;
+    buffer->lru_next = bcache_lru_head;
+    if (bcache_lru_head)
+        bcache_lru_head->lru_prev = buffer;
+    bcache_lru_head = buffer;
+
+    if (!bcache_lru_tail)
+        bcache_lru_tail = buffer;
+}
+
+static void bcache_hash_remove(struct bcache_buffer *buffer)
+{
+    struct bcache_buffer **link = &bcache_hash[bcache_hash_index(buffer->disk, buffer->lba)];
+
+    while (*link && *link != buffer)
+        link = &(*link)->hash_next;
+
+    if (*link)
+        *link = buffer->hash_next;
+
+    buffer->hash_next = NULL;
+}
+
+static struct bcache_buffer *bcache_lookup(struct disk *disk, uint32_t lba)
+{
+    struct bcache_buffer *buffer = bcache_hash[bcache_hash_index(disk, lba)];
+
+    while (buffer) {
+        if (buffer->disk == disk && buffer->lba == lba)
+            return buffer;
+        buffer = buffer->hash_next;
+    }
+
+    return NULL;
+}
+
+/* A new buffer while under budget, otherwise recycle the least recently used clean one */
+static struct bcache_buffer *bcache_get_free_buffer(void)
+{
+    struct bcache_buffer *buffer;
+
+    if (bcache_stats.buffers < BCACHE_MAX_BUFFERS) {
+        buffer = kmem_cache_zalloc(bcache_buffer_cache);
+        if (buffer) {
+            bcache_stats.buffers++;
+            return buffer;
+        }
+    }
+
+    buffer = bcache_lru_tail;
+    while (buffer && (buffer->dirty || buffer->writeback))
+        buffer = buffer->lru_prev;
+
+    if (!buffer)
+        return NULL;
+
+    bcache_lru_remove(buffer);
+    bcache_hash_remove(buffer);
+    bcache_stats.evictions++;
+    if (buffer->prefetched)
+        bcache_stats.prefetch_wasted++;
+
+    return buffer;
+}
+
+static struct bcache_buffer *bcache_new_buffer(struct disk *disk, uint32_t lba)
+{
+    struct bcache_buffer *buffer = bcache_get_free_buffer();
+    uint32_t index;
+
+    if (!buffer)
+        return NULL;
+
+    buffer->disk = disk;
+    buffer->lba = lba;
+    buffer->prefetched = false;
+    buffer->dirty = false;
+    buffer->writeback = false;
+
+    index = bcache_hash_index(disk, lba);
+    buffer->hash_next = bcache_hash[index];
+    bcache_hash[index] = buffer;
+
+    bcache_lru_insert_head(buffer);
+
+    return buffer;
+}
+
+static void bcache_insert(struct disk *disk, uint32_t lba, const void *data, bool prefetched)
+{
+    struct bcache_buffer *buffer;
+
+    // Cached by another task in the meantime
+    if (bcache_lookup(disk, lba))
+        return;
+
+    buffer = bcache_new_buffer(disk, lba);
+
+    // Not cached, no big deal
+    if (!buffer)
+        return;
+
+    buffer->prefetched = prefetched;
+    memcpy(buffer->data, (void *) data, PEACHOS_SECTOR_SIZE);
+}
+
+static void bcache_mark_dirty(struct bcache_buffer *buffer)
+{
+    if (buffer->dirty)
+        return;
+
+    buffer->dirty = true;
+    bcache_stats.dirty++;
+}
+
+/*
+ * Cached sectors are copied from the cache, each run of missing sectors is
+ * read with a single disk command straight into "buf" and then cached.
+ */
+int bcache_read(struct disk *disk, uint32_t lba, int total, void *buf)
+{
+    int res = 0;
+    int i = 0;
+
+    while (i < total) {
+        struct bcache_buffer *buffer = bcache_lookup(disk, lba + i);
+
+        if (buffer) {
+            memcpy(buf + (i * PEACHOS_SECTOR_SIZE), buffer->data, PEACHOS_SECTOR_SIZE);
+            bcache_lru_remove(buffer);
+            bcache_lru_insert_head(buffer);
+            bcache_stats.hits++;
+            if (buffer->prefetched) {
+                buffer->prefetched = false;
+                bcache_stats.prefetch_used++;
+            }
+            i++;
+            continue;
+        }
+
+        uint32_t generation = bcache_generation;
+        int run = 1;
+        while (i + run < total && !bcache_lookup(disk, lba + i + run))
+            run++;
+
+        res = disk_read_block_uncached(disk, lba + i, run, buf + (i * PEACHOS_SECTOR_SIZE));
+        if (res < 0)
+            break;
+
+        for (int j = 0; j < run && generation == bcache_generation; j++)
+            bcache_insert(disk, lba + i + j, buf + ((i + j) * PEACHOS_SECTOR_SIZE), false);
+
+        bcache_stats.misses += run;
+        i += run;
+    }
+
+    return res;
+}
+
+static void bcache_prefetch_end_io(struct bio *bio)
+{
+    struct bcache_prefetch *prefetch = bio->private;
+
+    if (bio->status == 0 && prefetch->generation == bcache_generation) {
+        for (uint32_t i = 0; i < bio->sectors; i++)
+            bcache_insert(bio->disk, bio->lba + i, prefetch->buffer + (i * PEACHOS_SECTOR_SIZE), true);
+
+        bcache_stats.prefetched += bio->sectors;
+    }
+
+    frame_free(prefetch->buffer, frame_count(bio->sectors * PEACHOS_SECTOR_SIZE));
+    kmem_cache_free(bcache_prefetch_cache, prefetch);
+}
+
+/* Queue a read of the sectors, it's done when a task waits for a request */
+static void bcache_prefetch_run(struct disk *disk, uint32_t lba, int total)
+{
+    struct bcache_prefetch *prefetch;
+
+    prefetch = kmem_cache_alloc(bcache_prefetch_cache);
+    if (!prefetch)
+        return;
+
+    prefetch->buffer = frame_alloc(frame_count(total * PEACHOS_SECTOR_SIZE));
+    if (!prefetch->buffer) {
+        kmem_cache_free(bcache_prefetch_cache, prefetch);
+        return;
+    }
+
+    prefetch->generation = bcache_generation;
+    bio_init(&prefetch->bio, disk, lba, false);
+    bio_add_buffer(&prefetch->bio, prefetch->buffer, total);
+    prefetch->bio.end_io = bcache_prefetch_end_io;
+    prefetch->bio.private = prefetch;
+
+    bio_submit(&prefetch->bio);
+}
+
+/*
+ * Read sectors that aren't cached yet ahead of a sequential reader, without
+ * waiting. Errors are ignored, the sectors will be read again on demand.
+ */
+void bcache_prefetch(struct disk *disk, uint32_t lba, int total)
+{
+    int i = 0;
+
+    if (total > PEACHOS_READAHEAD_MAX_SECTORS)
+        total = PEACHOS_READAHEAD_MAX_SECTORS;
+
+    while (i < total) {
+        if (bcache_lookup(disk, lba + i)) {
+            i++;
+            continue;
+        }
+
+        int run = 1;
+        while (i + run < total && !bcache_lookup(disk, lba + i + run))
+            run++;
+
+        bcache_prefetch_run(disk, lba + i, run);
+        i += run;
+    }
+}
+
+/*
+ * The sectors are copied to the cache and marked dirty. The ones that can't
+ * be cached, when all the buffers are dirty, are written through one at a
+ * time, so that a cached copy of the next sectors is still updated.
+ */
+int bcache_write(struct disk *disk, uint32_t lba, int total, const void *buf)
+{
+    int res;
+
+    if (bcache_stats.dirty >= PEACHOS_BCACHE_DIRTY_MAX) {
+        res = bcache_sync();
+        if (res < 0)
+            return res;
+    }
+
+    bcache_generation++;
+    bcache_unflushed_disk = disk;
+
+    for (int i = 0; i < total; i++) {
+        struct bcache_buffer *buffer = bcache_lookup(disk, lba + i);
+
+        if (!buffer)
+            buffer = bcache_new_buffer(disk, lba + i);
+
+        if (!buffer) {
+            res = disk_write_block_uncached(disk, lba + i, 1, buf + (i * PEACHOS_SECTOR_SIZE));
+            if (res < 0)
+                return res;
+
+            // A read queued during the write could have been served first
+            bcache_generation++;
+            continue;
+        }
+
+        memcpy(buffer->data, (void *) buf + (i * PEACHOS_SECTOR_SIZE), PEACHOS_SECTOR_SIZE);
+        buffer->prefetched = false;
+        bcache_mark_dirty(buffer);
+    }
+
+    return 0;
+}
+
+/*
+ * Submit the writes of up to BCACHE_SYNC_BATCH dirty sectors before waiting
+ * for them, the buffers being written can't be recycled. It returns the
+ * number of sectors written.
+ */
+static int bcache_sync_batch(struct bio *bios)
+{
+    struct bcache_buffer *buffer;
+    int total = 0;
+    int res = 0;
+
+    for (buffer = bcache_lru_head; buffer && total < BCACHE_SYNC_BATCH; buffer = buffer->lru_next) {
+        if (!buffer->dirty)
+            continue;
+
+        buffer->dirty = false;
+        buffer->writeback = true;
+        bcache_stats.dirty--;
+
+        bio_init(&bios[total], buffer->disk, buffer->lba, true);
+        bio_add_buffer(&bios[total], buffer->data, 1);
+        bios[total].private = buffer;
+        bio_submit(&bios[total]);
+        total++;
+    }
+
+    for (int i = 0; i < total; i++) {
+        buffer = bios[i].private;
+
+        // Written again later
+        if (bio_wait(&bios[i]) < 0) {
+            bcache_mark_dirty(buffer);
+            res = -EIO;
+        } else {
+            bcache_stats.written++;
+        }
+
+        buffer->writeback = false;
+    }
+
+    return res < 0 ? res : total;
+}
+
+/* Write the dirty sectors back and flush the disk cache */
+int bcache_sync(void)
+{
+    struct bio *bios;
+    uint32_t left;
+    int res = 0;
+
+    task_lock(&bcache_sync_lock);
+
+    bios = kmalloc(BCACHE_SYNC_BATCH * sizeof(struct bio));
+    if (!bios) {
+        res = -ENOMEM;
+        goto out;
+    }
+
+    // Sectors dirtied while syncing are left for the next sync
+    left = bcache_stats.dirty;
+    while (left > 0) {
+        res = bcache_sync_batch(bios);
+        if (res <= 0)
+            break;
+
+        left = (uint32_t) res < left ? left - res : 0;
+    }
+
+    kfree(bios);
+
+    if (res >= 0 && bcache_unflushed_disk) {
+        struct disk *disk = bcache_unflushed_disk;
+
+        bcache_unflushed_disk = NULL;
+        res = disk_flush(disk);
+        if (res < 0)
+            bcache_unflushed_disk = disk;
+    }
+
+    bcache_stats.syncs++;
+
+out:
+    bcache_last_sync = idt_get_ticks();
+    task_unlock(&bcache_sync_lock);
+    return res < 0 ? res : 0;
+}
+
+/* There is something to write back and the last sync is old enough */
+bool bcache_sync_due(void)
+{
+    if (!bcache_stats.dirty && !bcache_unflushed_disk)
+        return false;
+
+    return idt_get_ticks() - bcache_last_sync >= PEACHOS_BCACHE_FLUSH_TICKS;
+}
+
+void bcache_get_stats(struct bcache_stat *stat)
+{
+    memcpy(stat, &bcache_stats, sizeof(struct bcache_stat));
+}
+
+
+/* Drop the cached copy of a clean sector */
+static void bcache_forget(struct disk *disk, uint32_t lba)
+{
+    struct bcache_buffer *buffer = bcache_lookup(disk, lba);
+
+    if (!buffer || buffer->dirty || buffer->writeback)
+        return;
+
+    bcache_lru_remove(buffer);
+    bcache_hash_remove(buffer);
+    kmem_cache_free(bcache_buffer_cache, buffer);
+    bcache_stats.buffers--;
+}
+
+// Start of the boot counter left by bcache_selftest(), "BCAC"
+#define BCACHE_SELFTEST_MAGIC 0x43414342
+
+/* Contents of the sector after the scratch one once boot "boot" is over */
+static void bcache_selftest_marker(uint32_t *words, uint32_t boot)
+{
+    words[0] = BCACHE_SELFTEST_MAGIC;
+    words[1] = boot;
+    for (int i = 2; i < PEACHOS_SECTOR_SIZE / sizeof(uint32_t); i++)
+        words[i] = boot ^ (i * 0x9E3779B1);
+}
+
+/*
+ * Write a pattern to the scratch sector "lba" through the cache, sync it,
+ * drop it from the cache and read it back from the disk. The original
+ * contents are written back and synced.
+ *
+ * The sector after it holds the number of boots that ran the test. The
+ * marker written by the previous boot is checked against the disk, then
+ * the next one is written and synced for the next boot to check.
+ */
+void bcache_selftest(struct disk *disk, uint32_t lba)
+{
+    struct bcache_stat before;
+    const char *marker = "new";
+    uint32_t boot = 0;
+    bool restore = false;
+    bool ok = false;
+    char *original;
+    char *pattern;
+    char *check;
+
+    bcache_get_stats(&before);
+
+    original = kmalloc(3 * PEACHOS_SECTOR_SIZE);
+    if (!original) {
+        print("bcache: self-test out of memory\n");
+        return;
+    }
+
+    pattern = original + PEACHOS_SECTOR_SIZE;
+    check = pattern + PEACHOS_SECTOR_SIZE;
+
+    if (disk_read_block_uncached(disk, lba, 1, original) < 0)
+        goto out;
+
+    for (int i = 0; i < PEACHOS_SECTOR_SIZE; i++)
+        pattern[i] = ~original[i];
+
+    restore = true;
+    if (bcache_write(disk, lba, 1, pattern) < 0 || bcache_stats.dirty != before.dirty + 1)
+        goto out;
+
+    if (bcache_sync() < 0 || bcache_stats.dirty != 0)
+        goto out;
+
+    bcache_forget(disk, lba);
+    if (bcache_lookup(disk, lba) || disk_read_block_uncached(disk, lba, 1, check) < 0)
+        goto out;
+
+    ok = memcmp(check, pattern, PEACHOS_SECTOR_SIZE) == 0;
+
+out:
+    if (restore && (bcache_write(disk, lba, 1, original) < 0 || bcache_sync() < 0))
+        ok = false;
+
+    if (disk_read_block_uncached(disk, lba + 1, 1, check) < 0) {
+        marker = "unreadable";
+    } else if (((uint32_t *) check)[0] == BCACHE_SELFTEST_MAGIC) {
+        boot = ((uint32_t *) check)[1];
+        bcache_selftest_marker((uint32_t *) pattern, boot);
+        marker = memcmp(check, pattern, PEACHOS_SECTOR_SIZE) == 0 ? "ok" : "FAILED";
+    }
+
+    bcache_selftest_marker((uint32_t *) pattern, boot + 1);
+    if (bcache_write(disk, lba + 1, 1, pattern) < 0 || bcache_sync() < 0)
+        ok = false;
+
+    print(ok ? "bcache: write-back ok, " : "bcache: write-back FAILED, ");
+    print_number(bcache_stats.written - before.written);
+    print(" sectors by ");
+    print_number(bcache_stats.syncs - before.syncs);
+    print(" syncs, boot ");
+    print_number(boot + 1);
+    print(" marker ");
+    print(marker);
+    print("\n");
+
+    kfree(original);
+}
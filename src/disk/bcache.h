@@ -0,0 +1,66 @@
+/*
+ * Disk buffer cache
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#ifndef DISK_BCACHE_H
+#define DISK_BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+struct disk;
+
+// A cached sector
+struct bcache_buffer {
+    struct disk *disk;
+    uint32_t lba;
+
+    // Read ahead and not used yet
+    bool prefetched;
+
+    // Newer than the disk, being written to the disk
+    bool dirty;
+    bool writeback;
+
+    // Next buffer in the same hash bucket
+    struct bcache_buffer *hash_next;
+
+    // Least recently used list, the head is the most recently used
+    struct bcache_buffer *lru_prev;
+    struct bcache_buffer *lru_next;
+
+    char data[PEACHOS_SECTOR_SIZE];
+};
+
+struct bcache_stat {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t buffers;
+    uint32_t max_buffers;
+
+    // Read-ahead sectors, used ones were hit before being evicted
+    uint32_t prefetched;
+    uint32_t prefetch_used;
+    uint32_t prefetch_wasted;
+
+    // Write-back
+    uint32_t dirty;
+    uint32_t written;
+    uint32_t syncs;
+};
+
+void bcache_init(void);
+int bcache_read(struct disk *disk, uint32_t lba, int total, void *buf);
+void bcache_prefetch(struct disk *disk, uint32_t lba, int total);
+int bcache_write(struct disk *disk, uint32_t lba, int total, const void *buf);
+int bcache_sync(void);
+bool bcache_sync_due(void);
+void bcache_get_stats(struct bcache_stat *stat);
+void bcache_selftest(struct disk *disk, uint32_t lba);
+
+#endif // DISK_BCACHE_H
@@ -0,0 +1,436 @@
+/*
+ * Block I/O request queue
+ *
+ * Bios are queued sorted by LBA. When the disk is idle, a task waiting for
+ * one of its bios dispatches the next request: the elevator picks the first
+ * bio at or after the end of the last request (C-LOOK), unless a bio was
+ * passed over for too long. The adjacent bios of the same direction are
+ * merged into the same disk command, and a read of sectors that a queued read
+ * already covers is served by copying them.
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#include "bio.h"
+#include "disk.h"
+#include "config.h"
+#include "status.h"
+#include "memory/memory.h"
+#include "task/task.h"
+#include "memory/heap/kheap.h"
+#include "kernel.h"
+
+// A request is one ATA command, the PRDT must describe all its buffers
+#define BIO_MAX_REQUEST_SECTORS 256
+#define BIO_MAX_REQUEST_VECS 64
+
+// Requests dispatched before a bio is served first, reads are waited for
+#define BIO_READ_DEADLINE 8
+#define BIO_WRITE_DEADLINE 32
+
+static struct bio *bio_queue;
+static bool bio_queue_busy;
+static uint32_t bio_queue_head;         // LBA after the last request
+static uint32_t bio_queue_dispatched;
+
+// Tasks waiting for their bios
+static struct task_wait_queue bio_wait_queue;
+
+static struct bio_stat bio_stats;
+static uint32_t bio_arrival_head;       // LBA after the last bio submitted
+
+// Reads queued out of order by bio_selftest(), with the disk head at BIO_SELFTEST_HEAD
+#define BIO_SELFTEST_BIOS 6
+#define BIO_SELFTEST_HEAD 200
+#define BIO_SELFTEST_MAX_SECTORS 4
+
+void bio_init(struct bio *bio, struct disk *disk, uint32_t lba, bool write)
+{
+    memset(bio, 0, sizeof(struct bio));
+    bio->disk = disk;
+    bio->lba = lba;
+    bio->write = write;
+}
+
+int bio_add_buffer(struct bio *bio, void *buf, uint32_t sectors)
+{
+    if (bio->total_vecs >= BIO_MAX_VECS)
+        return -EINVARG;
+
+    bio->vecs[bio->total_vecs].buf = buf;
+    bio->vecs[bio->total_vecs].sectors = sectors;
+    bio->total_vecs++;
+    bio->sectors += sectors;
+
+    return 0;
+}
+
+void bio_iter_init(struct bio_iter *iter, struct bio *bio)
+{
+    iter->bio = bio;
+    iter->vec = 0;
+    iter->offset = 0;
+}
+
+/* Next contiguous piece of at most "max" bytes of the request, 0 at the end */
+uint32_t bio_iter_next(struct bio_iter *iter, uint32_t max, void **buf)
+{
+    struct bio_vec *vec = NULL;
+    uint32_t len = 0;
+
+    while (iter->bio) {
+        if (iter->vec < iter->bio->total_vecs) {
+            vec = &iter->bio->vecs[iter->vec];
+            len = (vec->sectors * PEACHOS_SECTOR_SIZE) - iter->offset;
+            if (len > 0)
+                break;
+
+            iter->vec++;
+            iter->offset = 0;
+            continue;
+        }
+
+        iter->bio = iter->bio->merged;
+        iter->vec = 0;
+        iter->offset = 0;
+    }
+
+    if (!iter->bio)
+        return 0;
+
+    if (len > max)
+        len = max;
+
+    *buf = vec->buf + iter->offset;
+    iter->offset += len;
+
+    return len;
+}
+
+static uint32_t bio_distance(uint32_t lba1, uint32_t lba2)
+{
+    return lba1 > lba2 ? lba1 - lba2 : lba2 - lba1;
+}
+
+/* A queued read that covers all the sectors of "bio" */
+static struct bio *bio_queue_find_cover(struct bio *bio)
+{
+    for (struct bio *b = bio_queue; b && b->lba <= bio->lba; b = b->next) {
+        if (!b->write && b->disk == bio->disk && b->lba + b->sectors >= bio->lba + bio->sectors)
+            return b;
+    }
+
+    return NULL;
+}
+
+void bio_submit(struct bio *bio)
+{
+    struct bio **link = &bio_queue;
+    struct bio *cover;
+
+    bio->status = 0;
+    bio->done = false;
+    bio->next = NULL;
+    bio->merged = NULL;
+    bio->aliases = NULL;
+    bio->deadline = bio_queue_dispatched + (bio->write ? BIO_WRITE_DEADLINE : BIO_READ_DEADLINE);
+
+    if (!bio->flush) {
+        bio_stats.bios++;
+        bio_stats.arrival_travel += bio_distance(bio_arrival_head, bio->lba);
+        bio_arrival_head = bio->lba + bio->sectors;
+    }
+
+    if (!bio->write) {
+        cover = bio_queue_find_cover(bio);
+        if (cover) {
+            bio->next = cover->aliases;
+            cover->aliases = bio;
+            return;
+        }
+    }
+
+    while (*link && (*link)->lba <= bio->lba)
+        link = &(*link)->next;
+
+    bio->next = *link;
+    *link = bio;
+}
+
+static void bio_queue_remove(struct bio *bio)
+{
+    struct bio **link = &bio_queue;
+
+    while (*link && *link != bio)
+        link = &(*link)->next;
+
+    if (*link)
+        *link = bio->next;
+
+    bio->next = NULL;
+}
+
+/* An expired bio, otherwise the first one ahead of the disk head, wrapping around */
+static struct bio *bio_queue_pick(void)
+{
+    struct bio *expired = NULL;
+    struct bio *ahead = NULL;
+
+    for (struct bio *b = bio_queue; b; b = b->next) {
+        if (b->deadline <= bio_queue_dispatched && (!expired || b->deadline < expired->deadline))
+            expired = b;
+
+        if (!ahead && b->lba >= bio_queue_head)
+            ahead = b;
+    }
+
+    if (expired)
+        return expired;
+
+    return ahead ? ahead : bio_queue;
+}
+
+/* A queued bio that ends where "lba" starts, or starts at "lba" */
+static struct bio *bio_queue_find_adjacent(struct bio *request, uint32_t lba, bool before)
+{
+    for (struct bio *b = bio_queue; b; b = b->next) {
+        if (b->write != request->write || b->disk != request->disk || b->flush || request->flush)
+            continue;
+
+        if ((before && b->lba + b->sectors == lba) || (!before && b->lba == lba))
+            return b;
+    }
+
+    return NULL;
+}
+
+static bool bio_request_fits(uint32_t sectors, int vecs, struct bio *bio)
+{
+    return sectors + bio->sectors <= BIO_MAX_REQUEST_SECTORS &&
+           vecs + bio->total_vecs <= BIO_MAX_REQUEST_VECS;
+}
+
+/* Take "bio" and the adjacent bios off the queue, chained in LBA order */
+static struct bio *bio_queue_build_request(struct bio *bio)
+{
+    struct bio *first = bio;
+    struct bio *last = bio;
+    uint32_t sectors = bio->sectors;
+    int vecs = bio->total_vecs;
+    struct bio *b;
+
+    bio_queue_remove(bio);
+
+    while ((b = bio_queue_find_adjacent(bio, first->lba, true)) && bio_request_fits(sectors, vecs, b)) {
+        bio_queue_remove(b);
+        b->merged = first;
+        first = b;
+        sectors += b->sectors;
+        vecs += b->total_vecs;
+    }
+
+    while ((b = bio_queue_find_adjacent(bio, last->lba + last->sectors, false)) &&
+           bio_request_fits(sectors, vecs, b)) {
+        bio_queue_remove(b);
+        last->merged = b;
+        last = b;
+        sectors += b->sectors;
+        vecs += b->total_vecs;
+    }
+
+    bio_queue_head = last->lba + last->sectors;
+
+    return first;
+}
+
+/* Copy the sectors of "alias" from the bio that read them */
+static void bio_copy_alias(struct bio *alias, struct bio *bio)
+{
+    struct bio_iter from;
+    struct bio_iter to;
+    void *src;
+    void *dst;
+
+    bio_iter_init(&from, bio);
+    for (uint32_t i = bio->lba; i < alias->lba; i++)
+        bio_iter_next(&from, PEACHOS_SECTOR_SIZE, &src);
+
+    bio_iter_init(&to, alias);
+    for (uint32_t i = 0; i < alias->sectors; i++) {
+        bio_iter_next(&from, PEACHOS_SECTOR_SIZE, &src);
+        bio_iter_next(&to, PEACHOS_SECTOR_SIZE, &dst);
+        memcpy(dst, src, PEACHOS_SECTOR_SIZE);
+    }
+}
+
+/* The callback can free the bio */
+static void bio_complete(struct bio *bio, int status)
+{
+    struct bio *alias = bio->aliases;
+
+    while (alias) {
+        struct bio *next = alias->next;
+
+        if (status == 0)
+            bio_copy_alias(alias, bio);
+
+        bio_complete(alias, status);
+        alias = next;
+    }
+
+    bio->status = status;
+    bio->done = true;
+    if (bio->end_io)
+        bio->end_io(bio);
+}
+
+static void bio_queue_dispatch(void)
+{
+    struct bio *request;
+    uint32_t head = bio_queue_head;
+    int res;
+
+    if (!bio_queue)
+        return;
+
+    request = bio_queue_build_request(bio_queue_pick());
+    bio_queue_dispatched++;
+
+    if (!request->flush) {
+        bio_stats.requests++;
+        bio_stats.travel += bio_distance(head, request->lba);
+    }
+
+    bio_queue_busy = true;
+    res = disk_transfer(request);
+    bio_queue_busy = false;
+
+    while (request) {
+        struct bio *next = request->merged;
+
+        bio_complete(request, res);
+        request = next;
+    }
+
+    task_wake_up(&bio_wait_queue);
+}
+
+/* Dispatch requests while the disk is idle, until "bio" is done */
+int bio_wait(struct bio *bio)
+{
+    while (!bio->done) {
+        if (!bio_queue_busy)
+            bio_queue_dispatch();
+        else
+            task_sleep_on(&bio_wait_queue);
+    }
+
+    return bio->status;
+}
+
+int bio_submit_wait(struct bio *bio)
+{
+    bio_submit(bio);
+    return bio_wait(bio);
+}
+
+
+static void bio_selftest_end_io(struct bio *bio)
+{
+    *(uint32_t *) bio->private = bio_queue_dispatched;
+}
+
+void bio_get_stats(struct bio_stat *stat)
+{
+    memcpy(stat, &bio_stats, sizeof(struct bio_stat));
+}
+
+/*
+ * Queue reads out of order and check the dispatch order of the elevator, the
+ * merge of adjacent bios and the copy of a read covered by another one. The
+ * sectors the disk head travels over are compared with the submission order.
+ */
+void bio_selftest(struct disk *disk)
+{
+    // From the head at 200: 300 (with the alias 301), 500, then wrapping around 50, 100 merged with 104
+    static const uint32_t lbas[BIO_SELFTEST_BIOS] = { 300, 100, 50, 500, 104, 301 };
+    static const uint32_t sectors[BIO_SELFTEST_BIOS] = { 4, 4, 4, 4, 4, 1 };
+    static const uint32_t expected[BIO_SELFTEST_BIOS] = { 1, 4, 3, 2, 4, 1 };
+    struct bio bios[BIO_SELFTEST_BIOS];
+    uint32_t dispatched[BIO_SELFTEST_BIOS];
+    uint32_t fifo_seek = 0;
+    uint32_t seek = 0;
+    uint32_t requests;
+    uint32_t first;
+    uint32_t head;
+    bool ok = true;
+    char *buf;
+
+    buf = kmalloc(BIO_SELFTEST_BIOS * BIO_SELFTEST_MAX_SECTORS * PEACHOS_SECTOR_SIZE);
+    if (!buf) {
+        print("bio: self-test out of memory\n");
+        return;
+    }
+
+    // Start with an empty queue
+    while (bio_queue)
+        bio_queue_dispatch();
+
+    bio_queue_head = BIO_SELFTEST_HEAD;
+    first = bio_queue_dispatched;
+
+    for (int i = 0; i < BIO_SELFTEST_BIOS; i++) {
+        bio_init(&bios[i], disk, lbas[i], false);
+        bio_add_buffer(&bios[i], buf + (i * BIO_SELFTEST_MAX_SECTORS * PEACHOS_SECTOR_SIZE), sectors[i]);
+        bios[i].end_io = bio_selftest_end_io;
+        bios[i].private = &dispatched[i];
+        bio_submit(&bios[i]);
+    }
+
+    for (int i = 0; i < BIO_SELFTEST_BIOS; i++) {
+        if (bio_wait(&bios[i]) < 0 || dispatched[i] - first != expected[i])
+            ok = false;
+    }
+
+    // The alias got the second sector read for 300
+    if (memcmp(buf + (5 * BIO_SELFTEST_MAX_SECTORS * PEACHOS_SECTOR_SIZE), buf + PEACHOS_SECTOR_SIZE, PEACHOS_SECTOR_SIZE) != 0)
+        ok = false;
+
+    requests = bio_queue_dispatched - first;
+
+    head = BIO_SELFTEST_HEAD;
+    for (uint32_t request = 1; request <= requests; request++) {
+        uint32_t start = 0xFFFFFFFF;
+        uint32_t end = 0;
+
+        for (int i = 0; i < BIO_SELFTEST_BIOS; i++) {
+            if (dispatched[i] - first != request)
+                continue;
+            if (lbas[i] < start)
+                start = lbas[i];
+            if (lbas[i] + sectors[i] > end)
+                end = lbas[i] + sectors[i];
+        }
+
+        seek += bio_distance(head, start);
+        head = end;
+    }
+
+    head = BIO_SELFTEST_HEAD;
+    for (int i = 0; i < BIO_SELFTEST_BIOS; i++) {
+        fifo_seek += bio_distance(head, lbas[i]);
+        head = lbas[i] + sectors[i];
+    }
+
+    print(ok ? "bio: C-LOOK order ok, " : "bio: C-LOOK order FAILED, ");
+    print_number(BIO_SELFTEST_BIOS);
+    print(" bios in ");
+    print_number(requests);
+    print(" requests, seek ");
+    print_number(seek);
+    print(" sectors vs ");
+    print_number(fifo_seek);
+    print(" in FIFO order\n");
+
+    kfree(buf);
+}
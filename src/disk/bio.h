@@ -0,0 +1,76 @@
+/*
+ * Block I/O requests
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#ifndef DISK_BIO_H
+#define DISK_BIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Buffers of a single bio
+#define BIO_MAX_VECS 4
+
+struct disk;
+struct bio;
+
+typedef void (*BIO_END_IO)(struct bio *bio);
+
+// A buffer of whole sectors
+struct bio_vec {
+    void *buf;
+    uint32_t sectors;
+};
+
+struct bio {
+    struct disk *disk;
+    uint32_t lba;
+    uint32_t sectors;
+    bool write;
+    bool flush;     // write the disk cache out, no sectors
+
+    struct bio_vec vecs[BIO_MAX_VECS];
+    int total_vecs;
+
+    // Called when the transfer is over, "status" is 0 or a negative error
+    BIO_END_IO end_io;
+    void *private;
+    int status;
+    bool done;
+
+    // Request queue
+    uint32_t deadline;      // dispatches the bio can be passed over
+    struct bio *next;       // queued bios sorted by LBA, or the next alias
+    struct bio *merged;     // next bio of the same disk command
+    struct bio *aliases;    // reads of sectors this bio reads, served by copy
+};
+
+// Work of the request queue, and what the same bios would cost in arrival order
+struct bio_stat {
+    uint32_t bios;              // submitted, each one a disk command in arrival order
+    uint32_t requests;          // disk commands
+    uint32_t travel;            // sectors the disk head moved over between commands
+    uint32_t arrival_travel;    // same, serving the bios in arrival order
+};
+
+// Position in the buffers of a request
+struct bio_iter {
+    struct bio *bio;
+    int vec;
+    uint32_t offset;    // bytes into the buffer
+};
+
+void bio_init(struct bio *bio, struct disk *disk, uint32_t lba, bool write);
+int bio_add_buffer(struct bio *bio, void *buf, uint32_t sectors);
+void bio_submit(struct bio *bio);
+int bio_wait(struct bio *bio);
+int bio_submit_wait(struct bio *bio);
+void bio_get_stats(struct bio_stat *stat);
+void bio_selftest(struct disk *disk);
+
+void bio_iter_init(struct bio_iter *iter, struct bio *bio);
+uint32_t bio_iter_next(struct bio_iter *iter, uint32_t max, void **buf);
+
+#endif // DISK_BIO_H
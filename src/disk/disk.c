@@ -6,49 +6,528 @@
 
 // ATA commands: https://wiki.osdev.org/ATA_Command_Matrix
 
+#include <stdbool.h>
+
 #include "io/io.h"
 #include "disk/disk.h"
+#include "disk/streamer.h"
+#include "disk/bcache.h"
+#include "disk/bio.h"
 #include "memory/memory.h"
+#include "idt/idt.h"
+#include "task/task.h"
+#include "memory/frame/frame.h"
+#include "pci/pci.h"
+#include "kernel.h"
 #include "config.h"
 #include "status.h"
 
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_BSY 0x80
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_CACHE_FLUSH 0xE7
+
+// The sector count register is 8 bits, 0 is 256
+#define DISK_MAX_SECTORS_PER_COMMAND 256
+
+// Bus master IDE registers, https://wiki.osdev.org/ATA/ATAPI_using_DMA
+#define BM_COMMAND 0x00
+#define BM_STATUS 0x02
+#define BM_PRDT 0x04
+
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ 0x08    // Disk to memory
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define PRD_END_OF_TABLE 0x8000
+
+// Read by each transfer method of disk_selftest(), 1MB
+#define DISK_SELFTEST_SECTORS 2048
+
+// PIT channel 2 counts down at 1193182Hz, one-shot of 10ms
+#define PIT_CHANNEL2_DATA 0x42
+#define PIT_COMMAND 0x43
+#define PIT_CHANNEL2_GATE 0x61
+#define PIT_CHANNEL2_10MS 11932
+
+// Physical Region Descriptor, a memory region of a DMA transfer
+struct disk_prd {
+    uint32_t address;
+    uint16_t byte_count;
+    uint16_t flags;
+} __attribute__((packed));
+
 struct disk primary_disk;
 
+// Tasks waiting for the disk interrupt
+static struct task_wait_queue disk_wait_queue;
+static volatile bool disk_interrupt_received;
+
+// Bus master I/O ports of the primary channel, 0 if there is no DMA
+static unsigned short disk_dma_base;
+static struct disk_prd *disk_prdt;
+
+static struct disk_stat disk_stats;
+
+static void disk_handle_interrupt(void)
+{
+    // Reading the status acknowledges the interrupt
+    insb(0x1F7);
+    disk_interrupt_received = true;
+    task_wake_up(&disk_wait_queue);
+}
+
 /*
- * lba = logical block address
- * total = total number of blocks to read from the lba
- * buf
+ * Wait until the disk isn't busy and, with "drq", until the next sector can
+ * be transferred. If the disk raises an interrupt for it, tasks sleep until
+ * the interrupt, during the boot the status port is polled.
  */
-int  disk_read_sector(int lba, int total, void *buf)
+static int disk_wait(bool interrupt, bool drq)
+{
+    unsigned char status;
+
+    while (true) {
+        if (interrupt && task_can_sleep()) {
+            while (!disk_interrupt_received)
+                task_sleep_on(&disk_wait_queue);
+            disk_interrupt_received = false;
+        }
+
+        status = insb(0x1F7);
+        if (status & ATA_STATUS_ERR)
+            return -EIO;
+
+        if (!(status & ATA_STATUS_BSY) && (!drq || (status & ATA_STATUS_DRQ)))
+            return 0;
+    }
+}
+
+/* https://wiki.osdev.org/ATA_read/write_sectors */
+static void disk_ata_command(int lba, int total, unsigned char command)
 {
-    /* https://wiki.osdev.org/ATA_read/write_sectors */
     outb(0x1F6, (lba >> 24) | 0xE0);
-    outb(0x1F2, total);
+    outb(0x1F2, total);     // 256 sectors is written as 0
     outb(0x1F3, (unsigned char) (lba & 0xff));
     outb(0x1F4, (unsigned char) (lba >> 8));
     outb(0x1F5, (unsigned char) (lba >> 16));
-    outb(0x1F7, 0x20);
+    outb(0x1F7, command);
+}
+
+static int disk_pio_read(int lba, int total, struct bio_iter *iter)
+{
+    void *buf;
+    int res = 0;
+
+    disk_interrupt_received = false;
+    disk_ata_command(lba, total, ATA_CMD_READ_PIO);
 
-    /* Read two bytes at a time */
-    unsigned short *ptr = (unsigned short *) buf;
     for (int b = 0; b < total; b++) {
 
         // Wait for the buffer to be ready
-        char c = insb(0x1F7);
-        while (!(c & 0x08))
-            c = insb(0x1F7);
-
-        // Copy from primary hard disk to memory
-        for (int i = 0; i < 256; i++) {
-            *ptr = insw(0x1F0);
-            ptr++;
+        res = disk_wait(true, true);
+        if (res < 0)
+            break;
+
+        // Copy from primary hard disk to memory, a sector is 256 words
+        bio_iter_next(iter, PEACHOS_SECTOR_SIZE, &buf);
+        rep_insw(0x1F0, buf, PEACHOS_SECTOR_SIZE / 2);
+    }
+
+    return res;
+}
+
+static int disk_pio_write(int lba, int total, struct bio_iter *iter)
+{
+    void *buf;
+    int res = 0;
+
+    disk_interrupt_received = false;
+    disk_ata_command(lba, total, ATA_CMD_WRITE_PIO);
+
+    for (int b = 0; b < total; b++) {
+
+        // There is no interrupt before the first sector, only after each one
+        res = disk_wait(b > 0, true);
+        if (res < 0)
+            return res;
+
+        bio_iter_next(iter, PEACHOS_SECTOR_SIZE, &buf);
+        rep_outsw(0x1F0, buf, PEACHOS_SECTOR_SIZE / 2);
+    }
+
+    // Wait for the last sector
+    return disk_wait(true, false);
+}
+
+/* Write the disk cache out to the media */
+static int disk_cache_flush(void)
+{
+    disk_interrupt_received = false;
+    outb(0x1F6, 0xE0);
+    outb(0x1F7, ATA_CMD_CACHE_FLUSH);
+
+    return disk_wait(true, false);
+}
+
+/* Wait for the end of the DMA transfer, sleeping on the disk interrupt if we can */
+static int disk_dma_wait(void)
+{
+    unsigned char status;
+
+    while (true) {
+        if (task_can_sleep()) {
+            while (!disk_interrupt_received)
+                task_sleep_on(&disk_wait_queue);
+            disk_interrupt_received = false;
         }
+
+        status = insb(disk_dma_base + BM_STATUS);
+        if (status & BM_STATUS_ERR)
+            return -EIO;
+
+        if (status & BM_STATUS_IRQ)
+            return 0;
+    }
+}
+
+/*
+ * The buffers are identity mapped, i.e. physically contiguous. Each one is
+ * described by one PRD per 64KB region it spans, a PRD can't cross a 64KB
+ * boundary. A request has at most BIO_MAX_REQUEST_VECS buffers of up to
+ * 128KB, so they fit in the PRDT frame.
+ */
+static int disk_dma_add_prds(int i, void *buf, uint32_t size)
+{
+    uint32_t addr = (uint32_t) buf;
+
+    while (size > 0) {
+        uint32_t len = 0x10000 - (addr & 0xFFFF);
+        if (len > size)
+            len = size;
+
+        disk_prdt[i].address = addr;
+        disk_prdt[i].byte_count = len & 0xFFFF;    // 0 is 64KB
+        disk_prdt[i].flags = 0;
+
+        addr += len;
+        size -= len;
+        i++;
+    }
+
+    return i;
+}
+
+static void disk_dma_setup_prdt(struct bio_iter *iter, uint32_t size)
+{
+    int i = 0;
+
+    while (size > 0) {
+        void *buf;
+        uint32_t len = bio_iter_next(iter, size, &buf);
+
+        i = disk_dma_add_prds(i, buf, len);
+        size -= len;
+    }
+
+    disk_prdt[i - 1].flags = PRD_END_OF_TABLE;
+}
+
+static int disk_dma_transfer(int lba, int total, struct bio_iter *iter, bool write)
+{
+    unsigned char direction = write ? 0 : BM_COMMAND_READ;
+    unsigned char status;
+    int res;
+
+    disk_dma_setup_prdt(iter, total * PEACHOS_SECTOR_SIZE);
+
+    // Stop, set the direction, clear the interrupt and error bits
+    outb(disk_dma_base + BM_COMMAND, direction);
+    outl(disk_dma_base + BM_PRDT, (uint32_t) disk_prdt);
+    outb(disk_dma_base + BM_STATUS, BM_STATUS_IRQ | BM_STATUS_ERR);
+
+    disk_interrupt_received = false;
+    disk_ata_command(lba, total, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    outb(disk_dma_base + BM_COMMAND, direction | BM_COMMAND_START);
+
+    res = disk_dma_wait();
+
+    outb(disk_dma_base + BM_COMMAND, direction);
+    outb(disk_dma_base + BM_STATUS, BM_STATUS_IRQ | BM_STATUS_ERR);
+
+    status = insb(0x1F7);
+    if (status & ATA_STATUS_ERR)
+        res = -EIO;
+
+    return res;
+}
+
+/* The PRDs need word aligned buffers */
+static bool disk_dma_can_transfer(struct bio *request)
+{
+    if (!disk_dma_base)
+        return false;
+
+    for (struct bio *bio = request; bio; bio = bio->merged) {
+        for (int i = 0; i < bio->total_vecs; i++) {
+            if ((uint32_t) bio->vecs[i].buf & 0x01)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Transfer a request of the queue, bios with consecutive sectors chained by
+ * "merged", at most DISK_MAX_SECTORS_PER_COMMAND sectors per command.
+ */
+int disk_transfer(struct bio *request)
+{
+    bool dma = disk_dma_can_transfer(request);
+    uint32_t lba = request->lba;
+    uint32_t total = 0;
+    struct bio_iter iter;
+    int res = 0;
+
+    if (request->flush) {
+        disk_stats.commands++;
+        return disk_cache_flush();
+    }
+
+    for (struct bio *bio = request; bio; bio = bio->merged)
+        total += bio->sectors;
+
+    bio_iter_init(&iter, request);
+
+    while (total > 0 && res == 0) {
+        int count = total > DISK_MAX_SECTORS_PER_COMMAND ? DISK_MAX_SECTORS_PER_COMMAND : total;
+
+        disk_stats.commands++;
+        disk_stats.sectors += count;
+
+        if (dma)
+            res = disk_dma_transfer(lba, count, &iter, request->write);
+        else if (request->write)
+            res = disk_pio_write(lba, count, &iter);
+        else
+            res = disk_pio_read(lba, count, &iter);
+
+        lba += count;
+        total -= count;
+    }
+
+    return res;
+}
+
+/*
+ * lba = logical block address
+ * total = total number of blocks to read from the lba
+ * buf
+ */
+int disk_read_sector(int lba, int total, void *buf)
+{
+    struct bio bio;
+
+    bio_init(&bio, &primary_disk, lba, false);
+    bio_add_buffer(&bio, buf, total);
+
+    return bio_submit_wait(&bio);
+}
+
+int disk_write_sector(int lba, int total, const void *buf)
+{
+    struct bio bio;
+
+    bio_init(&bio, &primary_disk, lba, true);
+    bio_add_buffer(&bio, (void *) buf, total);
+
+    return bio_submit_wait(&bio);
+}
+
+/* The sectors written so far are on the media once it returns */
+int disk_flush(struct disk *disk)
+{
+    struct bio bio;
+
+    if (disk != &primary_disk)
+        return -EIO;
+
+    bio_init(&bio, disk, 0, true);
+    bio.flush = true;
+
+    return bio_submit_wait(&bio);
+}
+
+typedef int (*DISK_READ_FUNCTION)(int lba, int total, struct bio_iter *iter);
+
+/* disk_pio_read() one word at a time, the baseline of rep insw */
+static int disk_pio_read_words(int lba, int total, struct bio_iter *iter)
+{
+    uint16_t *buf;
+    int res = 0;
+
+    disk_interrupt_received = false;
+    disk_ata_command(lba, total, ATA_CMD_READ_PIO);
+
+    for (int b = 0; b < total; b++) {
+        res = disk_wait(true, true);
+        if (res < 0)
+            break;
+
+        bio_iter_next(iter, PEACHOS_SECTOR_SIZE, (void **) &buf);
+        for (int i = 0; i < PEACHOS_SECTOR_SIZE / 2; i++)
+            buf[i] = insw(0x1F0);
+    }
+
+    return res;
+}
+
+static int disk_dma_read(int lba, int total, struct bio_iter *iter)
+{
+    return disk_dma_transfer(lba, total, iter, false);
+}
+
+/* Time stamp counter frequency, measured over a 10ms one-shot of PIT channel 2 */
+static uint32_t disk_selftest_tsc_hz(void)
+{
+    uint32_t start;
+
+    // Gate the channel on, keep the speaker off
+    outb(PIT_CHANNEL2_GATE, (insb(PIT_CHANNEL2_GATE) & ~0x02) | 0x01);
+
+    // Channel 2, low and high byte, mode 0: the output goes high at the end of the count
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2_DATA, PIT_CHANNEL2_10MS & 0xFF);
+    outb(PIT_CHANNEL2_DATA, PIT_CHANNEL2_10MS >> 8);
+
+    start = read_tsc();
+    while (!(insb(PIT_CHANNEL2_GATE) & 0x20)) {}
+
+    return (read_tsc() - start) * 100;
+}
+
+/* Cycles taken to read the first DISK_SELFTEST_SECTORS of the disk, 0 on errors */
+static uint32_t disk_selftest_read(DISK_READ_FUNCTION read, void *buf)
+{
+    uint32_t start = read_tsc();
+
+    for (int lba = 0; lba < DISK_SELFTEST_SECTORS; lba += DISK_MAX_SECTORS_PER_COMMAND) {
+        struct bio_iter iter;
+        struct bio bio;
+
+        bio_init(&bio, &primary_disk, lba, false);
+        bio_add_buffer(&bio, buf + (lba * PEACHOS_SECTOR_SIZE), DISK_MAX_SECTORS_PER_COMMAND);
+        bio_iter_init(&iter, &bio);
+
+        if (read(lba, DISK_MAX_SECTORS_PER_COMMAND, &iter) < 0)
+            return 0;
     }
-    return 0;
+
+    return read_tsc() - start;
+}
+
+static void disk_selftest_print_rate(const char *name, uint32_t cycles, uint32_t tsc_hz)
+{
+    uint32_t cycles_per_kb = cycles / (DISK_SELFTEST_SECTORS * PEACHOS_SECTOR_SIZE / 1024);
+
+    print(name);
+    if (!cycles) {
+        print(" failed");
+        return;
+    }
+
+    print_number(tsc_hz / (cycles_per_kb ? cycles_per_kb : 1));
+    print(" KB/s");
+}
+
+/*
+ * Throughput of the transfer methods, each one reading the first 1MB of the
+ * disk with commands of 256 sectors: PIO with rep insw, PIO with a loop of
+ * insw as a baseline, and DMA. It runs at boot, the disk is polled.
+ */
+void disk_selftest(void)
+{
+    uint32_t frames = frame_count(DISK_SELFTEST_SECTORS * PEACHOS_SECTOR_SIZE);
+    void *pio_buf = frame_alloc(frames);
+    void *dma_buf = frame_alloc(frames);
+    uint32_t tsc_hz = disk_selftest_tsc_hz();
+    uint32_t cycles;
+
+    if (!pio_buf || !dma_buf) {
+        print("disk: self-test out of memory\n");
+        goto out;
+    }
+
+    disk_selftest_print_rate("disk: PIO ", disk_selftest_read(disk_pio_read, pio_buf), tsc_hz);
+
+    cycles = disk_selftest_read(disk_pio_read_words, dma_buf);
+    disk_selftest_print_rate(" (insw loop ", cycles, tsc_hz);
+    if (cycles && memcmp(pio_buf, dma_buf, DISK_SELFTEST_SECTORS * PEACHOS_SECTOR_SIZE) != 0)
+        print(" with different data");
+    print(")");
+
+    if (disk_dma_base) {
+        cycles = disk_selftest_read(disk_dma_read, dma_buf);
+        disk_selftest_print_rate(", DMA ", cycles, tsc_hz);
+        if (cycles && memcmp(pio_buf, dma_buf, DISK_SELFTEST_SECTORS * PEACHOS_SECTOR_SIZE) != 0)
+            print(" with different data");
+    } else {
+        print(", no DMA");
+    }
+
+    print("\n");
+
+out:
+    if (pio_buf)
+        frame_free(pio_buf, frames);
+    if (dma_buf)
+        frame_free(dma_buf, frames);
+}
+
+/* Use the bus master DMA of the IDE controller, if there is one */
+static void disk_dma_init(void)
+{
+    struct pci_device ide;
+    uint32_t bar4;
+
+    if (pci_find_device(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, &ide) < 0)
+        return;
+
+    // Bit 7 of the programming interface, the controller supports bus mastering
+    if (!(ide.prog_if & 0x80))
+        return;
+
+    bar4 = pci_config_read(&ide, PCI_BAR4);
+    if (!(bar4 & 0x01))
+        return; // Not an I/O port address
+
+    disk_prdt = frame_zalloc(1);
+    if (!disk_prdt)
+        return;
+
+    pci_config_write(&ide, PCI_COMMAND,
+                     pci_config_read(&ide, PCI_COMMAND) | PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+
+    // The primary channel registers come first
+    disk_dma_base = bar4 & 0xFFFC;
 }
 
 void disk_search_and_init(void)
 {
+    dstreamer_init();
+    bcache_init();
+    disk_dma_init();
+
+    // Enable the disk interrupts (nIEN = 0)
+    idt_register_interrupt_callback(ISR_DISK_PRIMARY_INTERRUPT, disk_handle_interrupt);
+    outb(0x3F6, 0x00);
+
     memset(&primary_disk, 0, sizeof(primary_disk));
     primary_disk.type = PEACHOS_DISK_TYPE_REAL;
     primary_disk.id = 0;
@@ -64,10 +543,41 @@ struct disk *disk_get(int index)
     return &primary_disk;
 }
 
+/* Read through the buffer cache */
 int disk_read_block(struct disk *disk, unsigned int lba, int total, void *buf)
+{
+    if (disk != &primary_disk)
+        return -EIO;
+
+    return bcache_read(disk, lba, total, buf);
+}
+
+int disk_read_block_uncached(struct disk *disk, unsigned int lba, int total, void *buf)
 {
     if (disk != &primary_disk)
         return -EIO;
 
     return disk_read_sector(lba, total, buf);
-}
\ No newline at end of file
+}
+
+/* Write to the buffer cache, see bcache_sync() */
+int disk_write_block(struct disk *disk, unsigned int lba, int total, const void *buf)
+{
+    if (disk != &primary_disk)
+        return -EIO;
+
+    return bcache_write(disk, lba, total, buf);
+}
+
+int disk_write_block_uncached(struct disk *disk, unsigned int lba, int total, const void *buf)
+{
+    if (disk != &primary_disk)
+        return -EIO;
+
+    return disk_write_sector(lba, total, buf);
+}
+
+void disk_get_stats(struct disk_stat *stat)
+{
+    memcpy(stat, &disk_stats, sizeof(struct disk_stat));
+}
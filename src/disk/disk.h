@@ -14,6 +14,11 @@ typedef unsigned int PEACHOS_DISK_TYPE;
 // Represent a real physical hard disk
 #define PEACHOS_DISK_TYPE_REAL 0
 
+// IRQ 14, the primary ATA bus
+#define ISR_DISK_PRIMARY_INTERRUPT 0x2E
+
+struct bio;
+
 struct disk {
     PEACHOS_DISK_TYPE type;
     int sector_size;
@@ -27,8 +32,20 @@ struct disk {
     void *fs_private;
 };
 
+struct disk_stat {
+    uint32_t commands;      // ATA commands issued for the request queue
+    uint32_t sectors;       // sectors they transferred
+};
+
 void disk_search_and_init(void);
 struct disk *disk_get(int index);
 int disk_read_block(struct disk *disk, unsigned int lba, int total, void *buf);
+int disk_read_block_uncached(struct disk *disk, unsigned int lba, int total, void *buf);
+int disk_write_block(struct disk *disk, unsigned int lba, int total, const void *buf);
+int disk_write_block_uncached(struct disk *disk, unsigned int lba, int total, const void *buf);
+int disk_flush(struct disk *disk);
+int disk_transfer(struct bio *request);
+void disk_selftest(void);
+void disk_get_stats(struct disk_stat *stat);
 
 #endif // DISK_H
\ No newline at end of file
@@ -7,9 +7,21 @@
 #include <stdbool.h>
 
 #include "streamer.h"
-#include "memory/heap/kheap.h"
+#include "disk/bcache.h"
+#include "memory/memory.h"
+#include "memory/slab/slab.h"
+#include "kernel.h"
 #include "config.h"
 
+static struct kmem_cache *disk_stream_cache;
+
+void dstreamer_init(void)
+{
+    disk_stream_cache = kmem_cache_create("disk_stream", sizeof(struct disk_stream), NULL);
+    if (!disk_stream_cache)
+        panic("Failed to create the disk stream cache\n");
+}
+
 struct disk_stream *dstreamer_new(int disk_id)
 {
     struct disk *disk = disk_get(disk_id);
@@ -17,9 +29,13 @@ struct disk_stream *dstreamer_new(int disk_id)
     if (!disk)
         return NULL;
 
-    struct disk_stream *streamer = kzalloc(sizeof(struct disk_stream));
+    struct disk_stream *streamer = kmem_cache_zalloc(disk_stream_cache);
+    if (!streamer)
+        return NULL;
+
     streamer->pos = 0;
     streamer->disk = disk;
+    streamer->ra_last = -1;
 
     return streamer;
 }
@@ -34,41 +50,120 @@ int dstreamer_seek(struct disk_stream *stream, int pos)
     return 0;
 }
 
-int dstreamer_read(struct disk_stream *stream, void *out, int total)
+/* Read part of a single sector, through a sector buffer */
+static int dstreamer_read_partial(struct disk_stream *stream, void *out, int total)
+{
+    int sector = stream->pos / PEACHOS_SECTOR_SIZE;
+    int offset = stream->pos % PEACHOS_SECTOR_SIZE;
+    char buf[PEACHOS_SECTOR_SIZE] __attribute__((aligned(4)));
+    int res;
+
+    res = disk_read_block(stream->disk, sector, 1, buf);
+    if (res < 0)
+        return res;
+
+    memcpy(out, buf + offset, total);
+    stream->pos += total;
+
+    return 0;
+}
+
+/*
+ * A read that starts in or right after the last sector read is sequential.
+ * The window doubles each time it is prefetched and is halved, down to no
+ * read-ahead, by random reads. A new window is queued for reading once less
+ * than half a window is left ahead of the stream.
+ */
+static void dstreamer_readahead(struct disk_stream *stream, int first, int last)
 {
-    int res = 0;
-    bool overflow = false;
+    bool sequential = stream->ra_last >= 0 &&
+                      (first == stream->ra_last || first == stream->ra_last + 1);
+    int next = last + 1;
+
+    stream->ra_last = last;
+
+    if (!sequential) {
+        stream->ra_window /= 2;
+        if (stream->ra_window < PEACHOS_READAHEAD_MIN_SECTORS)
+            stream->ra_window = 0;
+        stream->ra_end = 0;
+        return;
+    }
+
+    if (stream->ra_window == 0)
+        stream->ra_window = PEACHOS_READAHEAD_MIN_SECTORS;
+
+    if (stream->ra_end < next)
+        stream->ra_end = next;
+
+    if (stream->ra_end - next >= stream->ra_window / 2)
+        return;
+
+    bcache_prefetch(stream->disk, stream->ra_end, stream->ra_window);
+    stream->ra_end += stream->ra_window;
 
-    do {
-        int sector = stream->pos / PEACHOS_SECTOR_SIZE;
-        int offset = stream->pos % PEACHOS_SECTOR_SIZE;
-        int bytes_to_read = total;
-        char buf[PEACHOS_SECTOR_SIZE];
-        int res;
+    if (stream->ra_window < PEACHOS_READAHEAD_MAX_SECTORS)
+        stream->ra_window *= 2;
+}
 
-        overflow = (offset + bytes_to_read) >= PEACHOS_SECTOR_SIZE;
+/*
+ * The request is split into an unaligned head, the whole sectors that are
+ * read with a single command straight into "out", and an unaligned tail.
+ */
+static int dstreamer_read_sectors(struct disk_stream *stream, void *out, int total)
+{
+    int offset = stream->pos % PEACHOS_SECTOR_SIZE;
+    int sectors;
+    int res;
 
-        if (overflow)
-            bytes_to_read -= (offset + bytes_to_read) - PEACHOS_SECTOR_SIZE;
+    if (offset && total > 0) {
+        int bytes_to_read = PEACHOS_SECTOR_SIZE - offset;
+        if (bytes_to_read > total)
+            bytes_to_read = total;
 
-        /* This assumes that the function is always able to read the number
-         * of blocks requested */
-        res = disk_read_block(stream->disk, sector, 1, buf);
+        res = dstreamer_read_partial(stream, out, bytes_to_read);
         if (res < 0)
             return res;
 
-        for (int i = 0; i < bytes_to_read; i++)
-            *(char *)out++ = buf[offset+i];
-    
-        // Adjust the stream
-        stream->pos += bytes_to_read;
+        out += bytes_to_read;
         total -= bytes_to_read;
-    } while (overflow);
-    
-    return res;
+    }
+
+    sectors = total / PEACHOS_SECTOR_SIZE;
+    if (sectors > 0) {
+        res = disk_read_block(stream->disk, stream->pos / PEACHOS_SECTOR_SIZE, sectors, out);
+        if (res < 0)
+            return res;
+
+        out += sectors * PEACHOS_SECTOR_SIZE;
+        total -= sectors * PEACHOS_SECTOR_SIZE;
+        stream->pos += sectors * PEACHOS_SECTOR_SIZE;
+    }
+
+    if (total > 0)
+        return dstreamer_read_partial(stream, out, total);
+
+    return 0;
+}
+
+int dstreamer_read(struct disk_stream *stream, void *out, int total)
+{
+    int first = stream->pos / PEACHOS_SECTOR_SIZE;
+    int res;
+
+    if (total <= 0)
+        return 0;
+
+    res = dstreamer_read_sectors(stream, out, total);
+    if (res < 0)
+        return res;
+
+    dstreamer_readahead(stream, first, (stream->pos - 1) / PEACHOS_SECTOR_SIZE);
+
+    return 0;
 }
 
 void dstreamer_close(struct disk_stream *stream)
 {
-    kfree(stream);
+    kmem_cache_free(disk_stream_cache, stream);
 }
\ No newline at end of file
@@ -12,8 +12,14 @@
 struct disk_stream {
     int pos;    // byte position
     struct disk *disk;
+
+    // Read-ahead
+    int ra_last;        // last sector read, -1 if none
+    int ra_end;         // sectors before this one were prefetched
+    int ra_window;      // sectors to prefetch, 0 for random access
 };
 
+void dstreamer_init(void);
 struct disk_stream *dstreamer_new(int disk_id);
 /*
  * @stream: handler returned by dstreamer_new()
@@ -0,0 +1,217 @@
+/*
+ * Directory entry cache
+ *
+ * Path lookups are cached one component at a time, indexed by (disk,
+ * parent directory, name) in a hash table, so that opening a path again
+ * doesn't read its directories. Names that were not found are cached too as
+ * negative entries. Once PEACHOS_DCACHE_ENTRIES are cached, the least
+ * recently used one is recycled.
+ *
+ * Names are compared ignoring the case, like the FAT names. The filesystem
+ * invalidates the entries of the directories it changes.
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#include "dcache.h"
+#include "kernel.h"
+#include "memory/memory.h"
+#include "memory/slab/slab.h"
+#include "string/string.h"
+
+#define DCACHE_HASH_BUCKETS 64
+
+static struct kmem_cache *dentry_cache;
+static struct dentry *dcache_hash[DCACHE_HASH_BUCKETS];
+static uint32_t dcache_entries;
+
+static struct dcache_stat dcache_stats;
+
+static struct dentry *dcache_lru_head;
+static struct dentry *dcache_lru_tail;
+
+void dcache_init(void)
+{
+    dentry_cache = kmem_cache_create("dentry", sizeof(struct dentry), NULL);
+    if (!dentry_cache)
+        panic("Failed to create the directory entry cache\n");
+}
+
+/* FNV-1a of the name in lower case, mixed with the parent and the disk */
+static uint32_t dcache_hash_index(struct disk *disk, uint32_t parent, const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (uint8_t) tolower(*name++);
+        hash *= 16777619;
+    }
+
+    hash ^= parent * 0x9E3779B1;
+    hash ^= (uint32_t) disk;
+
+    return hash % DCACHE_HASH_BUCKETS;
+}
+
+static void dcache_lru_remove(struct dentry *dentry)
+{
+    if (dentry->lru_prev)
+        dentry->lru_prev->lru_next = dentry->lru_next;
+    else
+        dcache_lru_head = dentry->lru_next;
+
+    if (dentry->lru_next)
+        dentry->lru_next->lru_prev = dentry->lru_prev;
+    else
+        dcache_lru_tail = dentry->lru_prev;
+
+    dentry->lru_prev = NULL;
+    dentry->lru_next = NULL;
+}
+
+static void dcache_lru_insert_head(struct dentry *dentry)
+{
+    dentry->lru_prev = NULL;
+    dentry->lru_next = dcache_lru_head;
+    if (dcache_lru_head)
+        dcache_lru_head->lru_prev = dentry;
+    dcache_lru_head = dentry;
+
+    if (!dcache_lru_tail)
+        dcache_lru_tail = dentry;
+}
+
+static void dcache_hash_remove(struct dentry *dentry)
+{
+    struct dentry **link = &dcache_hash[dcache_hash_index(dentry->disk, dentry->parent, dentry->name)];
+
+    while (*link && *link != dentry)
+        link = &(*link)->hash_next;
+
+    if (*link)
+        *link = dentry->hash_next;
+
+    dentry->hash_next = NULL;
+}
+
+static void dcache_remove(struct dentry *dentry)
+{
+    dcache_hash_remove(dentry);
+    dcache_lru_remove(dentry);
+    kmem_cache_free(dentry_cache, dentry);
+    dcache_entries--;
+}
+
+static struct dentry *dcache_find(struct disk *disk, uint32_t parent, const char *name)
+{
+    struct dentry *dentry = dcache_hash[dcache_hash_index(disk, parent, name)];
+
+    while (dentry) {
+        if (dentry->disk == disk && dentry->parent == parent &&
+            istrncmp(dentry->name, name, DCACHE_NAME_SIZE) == 0)
+            return dentry;
+        dentry = dentry->hash_next;
+    }
+
+    return NULL;
+}
+
+/*
+ * Cached lookup of "name" in "parent", NULL if it has to be read from the
+ * directory. The entry can be recycled once the caller sleeps.
+ */
+struct dentry *dcache_lookup(struct disk *disk, uint32_t parent, const char *name)
+{
+    struct dentry *dentry;
+
+    if (strnlen(name, DCACHE_NAME_SIZE) >= DCACHE_NAME_SIZE)
+        return NULL;
+
+    dentry = dcache_find(disk, parent, name);
+    if (!dentry) {
+        dcache_stats.misses++;
+        return NULL;
+    }
+
+    dcache_stats.hits++;
+    if (dentry->negative)
+        dcache_stats.negative_hits++;
+
+    dcache_lru_remove(dentry);
+    dcache_lru_insert_head(dentry);
+
+    return dentry;
+}
+
+/* Cache the directory entry "data" of "name", a negative entry if "data" is NULL */
+void dcache_add(struct disk *disk, uint32_t parent, const char *name, const void *data, size_t size)
+{
+    struct dentry *dentry;
+
+    if (strnlen(name, DCACHE_NAME_SIZE) >= DCACHE_NAME_SIZE || size > DCACHE_DATA_SIZE)
+        return;
+
+    dentry = dcache_find(disk, parent, name);
+    if (dentry) {
+        dcache_lru_remove(dentry);
+    } else if (dcache_entries < PEACHOS_DCACHE_ENTRIES) {
+        dentry = kmem_cache_zalloc(dentry_cache);
+        if (!dentry)
+            return;
+        dcache_entries++;
+    } else {
+        dentry = dcache_lru_tail;
+        dcache_lru_remove(dentry);
+        dcache_hash_remove(dentry);
+        memset(dentry, 0, sizeof(struct dentry));
+    }
+
+    if (!dentry->disk) {
+        uint32_t index = dcache_hash_index(disk, parent, name);
+
+        dentry->disk = disk;
+        dentry->parent = parent;
+        strncpy(dentry->name, name, DCACHE_NAME_SIZE);
+        dentry->hash_next = dcache_hash[index];
+        dcache_hash[index] = dentry;
+    }
+
+    dentry->negative = data == NULL;
+    memset(dentry->data, 0, DCACHE_DATA_SIZE);
+    if (data)
+        memcpy(dentry->data, (void *) data, size);
+
+    dcache_lru_insert_head(dentry);
+}
+
+void dcache_invalidate(struct disk *disk, uint32_t parent, const char *name)
+{
+    struct dentry *dentry;
+
+    if (strnlen(name, DCACHE_NAME_SIZE) >= DCACHE_NAME_SIZE)
+        return;
+
+    dentry = dcache_find(disk, parent, name);
+    if (dentry)
+        dcache_remove(dentry);
+}
+
+/* Drop all the entries of a disk, its filesystem changed */
+void dcache_invalidate_disk(struct disk *disk)
+{
+    struct dentry *dentry = dcache_lru_head;
+
+    while (dentry) {
+        struct dentry *next = dentry->lru_next;
+
+        if (dentry->disk == disk)
+            dcache_remove(dentry);
+        dentry = next;
+    }
+}
+
+void dcache_get_stats(struct dcache_stat *stat)
+{
+    memcpy(stat, &dcache_stats, sizeof(struct dcache_stat));
+    stat->entries = dcache_entries;
+}
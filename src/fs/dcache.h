@@ -0,0 +1,58 @@
+/*
+ * Directory entry cache
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+
+// Longer names are not cached
+#define DCACHE_NAME_SIZE 16
+
+// Directory entry of the filesystem, a FAT directory item is 32 bytes
+#define DCACHE_DATA_SIZE 32
+
+struct disk;
+
+// Result of looking up "name" in the directory "parent"
+struct dentry {
+    struct disk *disk;
+
+    // Identifies the parent directory within the filesystem
+    uint32_t parent;
+    char name[DCACHE_NAME_SIZE];
+
+    // The name doesn't exist in the parent directory
+    bool negative;
+    uint8_t data[DCACHE_DATA_SIZE];
+
+    // Next entry in the same hash bucket
+    struct dentry *hash_next;
+
+    // Least recently used list, the head is the most recently used
+    struct dentry *lru_prev;
+    struct dentry *lru_next;
+};
+
+struct dcache_stat {
+    uint32_t hits;
+    uint32_t negative_hits;     // hits of names that don't exist
+    uint32_t misses;
+    uint32_t entries;
+};
+
+void dcache_init(void);
+struct dentry *dcache_lookup(struct disk *disk, uint32_t parent, const char *name);
+void dcache_add(struct disk *disk, uint32_t parent, const char *name, const void *data, size_t size);
+void dcache_invalidate(struct disk *disk, uint32_t parent, const char *name);
+void dcache_invalidate_disk(struct disk *disk);
+void dcache_get_stats(struct dcache_stat *stat);
+
+#endif // DCACHE_H
@@ -5,20 +5,25 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "fat16.h"
+#include "fs/dcache.h"
 #include "string/string.h"
 #include "status.h"
 #include "disk/disk.h"
 #include "disk/streamer.h"
 #include "memory/memory.h"
 #include "memory/heap/kheap.h"
+#include "memory/slab/slab.h"
 #include "kernel.h"
 #include "config.h"
+#include "task/task.h"
 
 #define PEACHOS_FAT16_SIGNATURE  0x29
 #define PEACHOS_FAT16_FAT_ENTRY_SIZE 0x02
-#define PEACHOS_FAT16_BAD_SECTOR 0xFF7
+#define PEACHOS_FAT16_BAD_SECTOR 0xFFF7
+#define PEACHOS_FAT16_END_OF_CHAIN 0xFFF8
 #define PEACHOS_FAT16_UNUSED 0x00
 
 // Used only for internal representation, these don't go to disk
@@ -36,6 +41,9 @@ typedef unsigned int FAT_ITEM_TYPE;
 #define FAT_FILE_DEVICE 0x40
 #define FAT_FILE_RESERVED 0x80
 
+// Name and extension of the directory items, padded with spaces
+#define FAT_SHORT_NAME_SIZE 11
+
 struct fat_header_extended {
     uint8_t drive_number;
     uint8_t win_nt_bit;
@@ -100,23 +108,43 @@ struct fat_item {
     FAT_ITEM_TYPE type;
 };
 
+// A run of consecutive clusters of a file
+struct fat_extent {
+    uint32_t file_cluster;  // position of the run in the file, in clusters
+    uint32_t cluster;       // first cluster of the run
+    uint32_t length;        // clusters
+};
+
+// Cluster chain of a file, the extents are sorted by file_cluster
+struct fat_extent_map {
+    struct fat_extent *extents;
+    int total;
+};
+
 struct fat_file_descriptor {
     struct fat_item *item;
     uint32_t pos;
+
+    // File data, each open file has its own read-ahead
+    struct disk_stream *stream;
+
+    // Built on the first read
+    struct fat_extent_map map;
 };
 
 struct fat_private {
     struct fat_h header;
     struct fat_directory root_directory;
 
-    // Used to stream data clusters
+    // Used to stream the directory clusters
     struct disk_stream *cluster_read_stream;
 
-    // Used to stream the file allocation table
-    struct disk_stream *fat_read_stream;
-
     // Used in situations where we stream the directory
     struct disk_stream *directory_stream;
+
+    // The first file allocation table, loaded once the filesystem is resolved
+    uint16_t *fat_table;
+    uint32_t fat_table_entries;
 };
 
 int fat16_resolve(struct disk *disk);
@@ -125,6 +153,32 @@ int fat16_read(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmem
 int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
 int fat16_stat(struct disk *disk, void *private, struct file_stat *stat);
 int fat16_close(void *private);
+static int fat16_load_fat_table(struct disk *disk, struct fat_private *private);
+
+static struct kmem_cache *fat_item_cache;
+static struct kmem_cache *fat_directory_cache;
+static struct kmem_cache *fat_file_descriptor_cache;
+
+// The directory lookups share the streams of the filesystem and can sleep
+static struct task_lock fat16_lock;
+
+// Multi-cluster file of the root directory read by fat16_selftest(), see the Makefile
+#define FAT16_SELFTEST_FILE "data3.bin"
+
+// Longer runs of the mixed extent map, between single cluster extents
+#define FAT16_SELFTEST_RUN_LENGTH 3
+
+// Lookups of each name by fat16_selftest_lookups()
+#define FAT16_SELFTEST_LOOKUPS 10
+
+// Work of the filesystem, reported by fat16_selftest()
+struct fat16_stat {
+    uint32_t fat_lookups;       // FAT entries read from the copy in memory
+    uint32_t stream_reads;      // reads of file data from the disk stream
+    uint32_t directory_reads;   // reads of directory items from the disk stream
+};
+
+static struct fat16_stat fat16_stats;
 
 struct filesystem fat16_fs = {
     .resolve = fat16_resolve,
@@ -137,6 +191,13 @@ struct filesystem fat16_fs = {
 
 struct filesystem *fat16_init(void)
 {
+    fat_item_cache = kmem_cache_create("fat_item", sizeof(struct fat_item), NULL);
+    fat_directory_cache = kmem_cache_create("fat_directory", sizeof(struct fat_directory), NULL);
+    fat_file_descriptor_cache = kmem_cache_create("fat_file_descriptor", sizeof(struct fat_file_descriptor), NULL);
+
+    if (!fat_item_cache || !fat_directory_cache || !fat_file_descriptor_cache)
+        panic("Failed to create the FAT16 caches\n");
+
     strcpy(fat16_fs.name, "FAT16");
     return &fat16_fs;
 }
@@ -145,7 +206,6 @@ static void fat16_init_private(struct disk *disk, struct fat_private *private)
 {
     memset(private, 0, sizeof(struct fat_private));
     private->cluster_read_stream = dstreamer_new(disk->id);
-    private->fat_read_stream = dstreamer_new(disk->id);
     private->directory_stream = dstreamer_new(disk->id);
 }
 
@@ -154,95 +214,150 @@ int fat16_sector_to_absolute(struct disk *disk, int sector)
     return sector * disk->sector_size;
 }
 
-int fat16_get_total_items_for_directory(struct disk *disk, uint32_t directory_start_sector)
+/*
+ * Append the used items of a chunk of a directory being loaded, "end" is set
+ * once the end of the directory is found. Deleted items, long name entries
+ * and volume labels are left out.
+ */
+static int fat16_directory_add_items(struct fat_directory *directory, int *capacity,
+                                     struct fat_directory_item *chunk, int total, bool *end)
 {
-    struct fat_directory_item item;
-    struct fat_directory_item empty_item;
-    struct fat_private *fat_private;
-    struct disk_stream *stream;
-    int directory_start_pos;
-    int i;
+    for (int i = 0; i < total; i++) {
+        struct fat_directory_item *item = &chunk[i];
 
-    fat_private = disk->fs_private;
-    directory_start_pos = directory_start_sector * disk->sector_size;
-    stream = fat_private->directory_stream;
-    // FIXME: Nobody uses empty_item
-    memset(&empty_item, 0, sizeof(empty_item));
+        if (item->filename[0] == 0x00) {
+            *end = true;
+            break;
+        }
 
-    if (dstreamer_seek(stream, directory_start_pos) != PEACHOS_ALL_OK)
-        return -EIO;
+        if (item->filename[0] == 0xE5 || (item->attribute & FAT_FILE_VOLUME_LABEL))
+            continue;
 
-    i = 0;
-    while (1) {
-        if (dstreamer_read(stream, &item, sizeof(item)) != PEACHOS_ALL_OK)
-            return -EIO;
+        if (directory->total == *capacity) {
+            int new_capacity = *capacity ? *capacity * 2 : 16;
+            struct fat_directory_item *items;
 
-        if (item.filename[0] == 0x00)
-            break; // Done
+            items = kzalloc(new_capacity * sizeof(struct fat_directory_item));
+            if (!items)
+                return -ENOMEM;
 
-        if (item.filename[0] == 0xE5)
-            continue;
+            if (directory->item) {
+                memcpy(items, directory->item, directory->total * sizeof(struct fat_directory_item));
+                kfree(directory->item);
+            }
+
+            directory->item = items;
+            *capacity = new_capacity;
+        }
 
-        i++;
+        directory->item[directory->total++] = *item;
     }
 
-    return i;
+    return 0;
+}
+
+/* Compare the space padded 8.3 names, ignoring the case */
+static int fat16_compare_names(const uint8_t *name1, const uint8_t *name2)
+{
+    for (int i = 0; i < FAT_SHORT_NAME_SIZE; i++) {
+        uint8_t c1 = tolower(name1[i]);
+        uint8_t c2 = tolower(name2[i]);
+
+        if (c1 != c2)
+            return c1 - c2;
+    }
+
+    return 0;
+}
+
+/* Sort the items by name for fat16_find_item_in_directory() */
+static void fat16_sort_directory(struct fat_directory *directory)
+{
+    for (int i = 1; i < directory->total; i++) {
+        struct fat_directory_item item = directory->item[i];
+        int j = i;
+
+        while (j > 0 && fat16_compare_names(directory->item[j - 1].filename, item.filename) > 0) {
+            directory->item[j] = directory->item[j - 1];
+            j--;
+        }
+
+        directory->item[j] = item;
+    }
 }
 
 int fat16_get_root_directory(struct disk *disk, struct fat_private *fat_private, struct fat_directory *directory)
 {
     struct fat_header *primary_header;
+    struct fat_directory_item *chunk;
+    struct disk_stream *stream;
     int root_dir_sector_pos;
-    int root_dir_entries;
     int root_dir_size;
     int total_sectors;
-    int total_items;
-    struct fat_directory_item *dir;
-    struct disk_stream *stream;
+    int chunk_size;
+    int capacity = 0;
+    bool end = false;
     int err_code = 0;
 
     primary_header = &fat_private->header.primary_header;
     root_dir_sector_pos = (primary_header->fat_copies * primary_header->sectors_per_fat) +
                            primary_header->reserved_sectors;
-    root_dir_entries = fat_private->header.primary_header.root_dir_entries;
-    root_dir_size = root_dir_entries * sizeof(struct fat_directory_item);
+    root_dir_size = primary_header->root_dir_entries * sizeof(struct fat_directory_item);
     total_sectors = root_dir_size / disk->sector_size;
 
     if (root_dir_size % disk->sector_size)
         total_sectors++;
 
-    total_items = fat16_get_total_items_for_directory(disk, root_dir_sector_pos);
-    dir = kzalloc(root_dir_size);
-    if (!dir)
+    memset(directory, 0, sizeof(struct fat_directory));
+    directory->sector_pos = root_dir_sector_pos;
+    directory->ending_sector_pos = root_dir_sector_pos + total_sectors;
+
+    // The root directory is read a cluster worth of items at a time
+    chunk_size = primary_header->sectors_per_cluster * disk->sector_size;
+    chunk = kmalloc(chunk_size);
+    if (!chunk)
         return -ENOMEM;
 
     stream = fat_private->directory_stream;
     if (dstreamer_seek(stream, fat16_sector_to_absolute(disk, root_dir_sector_pos)) != PEACHOS_ALL_OK) {
         err_code = -EIO;
-        goto out_free;
+        goto out;
     }
 
-    if (dstreamer_read(stream, dir, root_dir_size) != PEACHOS_ALL_OK) {
-        err_code = -EIO;
-        goto out_free;
+    while (root_dir_size > 0 && !end) {
+        int size = root_dir_size < chunk_size ? root_dir_size : chunk_size;
+
+        if (dstreamer_read(stream, chunk, size) != PEACHOS_ALL_OK) {
+            err_code = -EIO;
+            goto out;
+        }
+        fat16_stats.directory_reads++;
+
+        err_code = fat16_directory_add_items(directory, &capacity, chunk,
+                                             size / sizeof(struct fat_directory_item), &end);
+        if (err_code < 0)
+            goto out;
+
+        root_dir_size -= size;
     }
 
-    directory->item = dir;
-    directory->total = total_items;
-    directory->sector_pos = root_dir_sector_pos;
-    directory->ending_sector_pos = root_dir_sector_pos + (root_dir_size / disk->sector_size);
+    fat16_sort_directory(directory);
 
-    return 0;
+out:
+    kfree(chunk);
+    if (err_code < 0 && directory->item) {
+        kfree(directory->item);
+        directory->item = NULL;
+        directory->total = 0;
+    }
 
-out_free:
-    kfree(dir);
     return err_code;
 }
 
 int fat16_resolve(struct disk *disk)
 {
     struct fat_private *fat_private;
-    struct disk_stream *stream;
+    struct disk_stream *stream = NULL;
     int res = 0;
 
     fat_private = kzalloc(sizeof(struct fat_private));
@@ -252,9 +367,15 @@ int fat16_resolve(struct disk *disk)
     }
 
     fat16_init_private(disk, fat_private);
+    dcache_invalidate_disk(disk);
     disk->fs_private = fat_private;
     disk->filesystem = &fat16_fs;
 
+    if (!fat_private->cluster_read_stream || !fat_private->directory_stream) {
+        res = -ENOMEM;
+        goto out;
+    }
+
     stream = dstreamer_new(disk->id);
     if (!stream) {
         res = -ENOMEM;
@@ -271,6 +392,10 @@ int fat16_resolve(struct disk *disk)
         goto out;
     }
 
+    res = fat16_load_fat_table(disk, fat_private);
+    if (res < 0)
+        goto out;
+
     if (fat16_get_root_directory(disk, fat_private, &fat_private->root_directory) != PEACHOS_ALL_OK) {
         res = -EIO;
         goto out;
@@ -280,39 +405,20 @@ out:
     if (stream)
         dstreamer_close(stream);
 
-    if (res < 0) {
+    if (res < 0 && fat_private) {
+        if (fat_private->cluster_read_stream)
+            dstreamer_close(fat_private->cluster_read_stream);
+        if (fat_private->directory_stream)
+            dstreamer_close(fat_private->directory_stream);
+        if (fat_private->fat_table)
+            kfree(fat_private->fat_table);
         kfree(fat_private);
         disk->fs_private = 0;
+        disk->filesystem = NULL;
     }
     return res;
 }
 
-// Replace space by null terminator
-void fat16_to_proper_string(char **out, const char *in)
-{
-    while (*in != 0x00 && *in != 0x20) {
-        **out = *in;
-        *out += 1;
-        in += 1;
-    }
-
-    if (*in == 0x20)
-        **out = 0x00;
-}
-
-void fat16_get_full_relative_filename(struct fat_directory_item * item, char *out, int max_len)
-{
-    char *out_tmp = out;
-
-    memset(out, 0x00, max_len);
-    fat16_to_proper_string(&out_tmp, (const char *) item->filename);
-
-    if (item->ext[0] != 0x00 && item->ext[0] != 0x20) {
-        *out_tmp++ = '.';
-        fat16_to_proper_string(&out_tmp, (const char *) item->ext);
-    }
-}
-
 struct fat_directory_item *fat16_clone_directory_item(struct fat_directory_item *item, int size)
 {
     struct fat_directory_item *item_copy;
@@ -340,36 +446,94 @@ static int fat16_cluster_to_sector(struct fat_private *private, int cluster)
            ((cluster - 2) * private->header.primary_header.sectors_per_cluster);
 }
 
+/* The sector "lba" is in a data cluster that the FAT marks free */
+bool fat16_is_free_sector(struct disk *disk, uint32_t lba)
+{
+    struct fat_private *private = disk->fs_private;
+    struct fat_header *header;
+    uint32_t first_data_sector;
+    uint32_t total_sectors;
+    uint32_t cluster;
+
+    if (disk->filesystem != &fat16_fs)
+        return false;
+
+    header = &private->header.primary_header;
+    total_sectors = header->number_of_sectors ? header->number_of_sectors : header->sectors_big;
+    first_data_sector = private->root_directory.ending_sector_pos;
+    if (lba < first_data_sector || lba >= total_sectors)
+        return false;
+
+    cluster = ((lba - first_data_sector) / header->sectors_per_cluster) + 2;
+    return cluster < private->fat_table_entries && private->fat_table[cluster] == 0;
+}
+
 static uint32_t fat16_get_first_fat_sector(struct fat_private *private)
 {
     return private->header.primary_header.reserved_sectors;
 }
 
-static int fat16_get_fat_entry(struct disk *disk, int cluster)
+/* Read the whole table with a single request, the chain walks never go to the disk */
+static int fat16_load_fat_table(struct disk *disk, struct fat_private *private)
 {
-    struct fat_private *private;
-    struct disk_stream *stream;
-    uint32_t fat_table_position;
-    uint16_t result;
+    uint32_t sectors = private->header.primary_header.sectors_per_fat;
     int res;
 
-    private = disk->fs_private;
-    stream = private->fat_read_stream;
-    if (!stream)
-        return -1;
-
-    fat_table_position = fat16_get_first_fat_sector(private) * disk->sector_size;
+    private->fat_table = kzalloc(sectors * disk->sector_size);
+    if (!private->fat_table)
+        return -ENOMEM;
 
-    res = dstreamer_seek(stream, fat_table_position * (cluster * PEACHOS_FAT16_FAT_ENTRY_SIZE));
-    if (res < 0)
+    res = disk_read_block_uncached(disk, fat16_get_first_fat_sector(private), sectors, private->fat_table);
+    if (res < 0) {
+        kfree(private->fat_table);
+        private->fat_table = NULL;
         return res;
+    }
 
-    result = 0;
-    res = dstreamer_read(stream, &result, sizeof(result));
-    if (res < 0)
-        return res;
+    private->fat_table_entries = (sectors * disk->sector_size) / PEACHOS_FAT16_FAT_ENTRY_SIZE;
+    return 0;
+}
+
+static int fat16_get_fat_entry(struct disk *disk, int cluster)
+{
+    struct fat_private *private = disk->fs_private;
+
+    if (cluster < 0 || cluster >= private->fat_table_entries)
+        return -EIO;
+
+    fat16_stats.fat_lookups++;
+    return private->fat_table[cluster];
+}
+
+/* The cluster after "cluster" in its chain, 0 at the end of the chain */
+static int fat16_get_next_cluster(struct disk *disk, int cluster)
+{
+    int entry;
+
+    // The first two entries don't describe clusters
+    if (cluster < 2)
+        return -EIO;
+
+    entry = fat16_get_fat_entry(disk, cluster);
+    if (entry < 0)
+        return entry;
+
+    // We are at the last entry in the file
+    if (entry >= PEACHOS_FAT16_END_OF_CHAIN)
+        return 0;
+
+    // Sector is marked as bad?
+    if (entry == PEACHOS_FAT16_BAD_SECTOR)
+        return -EIO;
+
+    // Reserved sector?
+    if (entry >= 0xFFF0 || entry == 0x01)
+        return -EIO;
+
+    if (entry == 0x00)
+        return -EIO;
 
-    return result;
+    return entry;
 }
 
 /**
@@ -383,70 +547,205 @@ static int fat16_get_cluster_for_offset(struct disk *disk, int starting_cluster,
     int clusters_ahead = offset / size_of_cluster_bytes;
 
     for(int i = 0; i < clusters_ahead; i++) {
-        int entry = fat16_get_fat_entry(disk, cluster_to_use);
+        int entry = fat16_get_next_cluster(disk, cluster_to_use);
 
-        // We are at the last entry in the file
-        if (entry == 0xFF8 || entry == 0xFFF)
+        if (entry <= 0)
             return -EIO;
 
-        // Sector is marked as bad?
-        if (entry == PEACHOS_FAT16_BAD_SECTOR)
-            return -EIO;
+        cluster_to_use = entry;
+    }
 
-        // Reserved sector?
-        if (entry == 0xFF0 || entry == 0xFF6)
-            return -EIO;
+    return cluster_to_use;
+}
+
+/*
+ * Walk the chain once, merging the consecutive clusters into extents. With
+ * "extents" NULL they are only counted.
+ */
+static int fat16_walk_extents(struct disk *disk, int cluster, struct fat_extent *extents)
+{
+    struct fat_private *private = disk->fs_private;
+    uint32_t run_cluster = cluster;
+    uint32_t run_file_cluster = 0;
+    uint32_t run_length = 0;
+    uint32_t file_cluster = 0;
+    int total = 0;
 
-        if (entry == 0x00)
+    while (true) {
+        int next;
+
+        // A longer chain has a loop
+        if (file_cluster >= private->fat_table_entries)
             return -EIO;
 
-        cluster_to_use = entry;
+        next = fat16_get_next_cluster(disk, cluster);
+        if (next < 0)
+            return next;
+
+        run_length++;
+        file_cluster++;
+
+        if (next != cluster + 1) {
+            if (extents) {
+                extents[total].file_cluster = run_file_cluster;
+                extents[total].cluster = run_cluster;
+                extents[total].length = run_length;
+            }
+            total++;
+
+            run_cluster = next;
+            run_file_cluster = file_cluster;
+            run_length = 0;
+        }
+
+        if (next == 0)
+            break;
+
+        cluster = next;
     }
 
-    return cluster_to_use;
+    return total;
 }
 
-static int fat16_read_internal_from_stream(struct disk *disk, struct disk_stream *stream, int cluster,
-                                           int offset, int total, void *out)
+static int fat16_build_extent_map(struct disk *disk, int cluster, struct fat_extent_map *map)
 {
-    struct fat_private *private = disk->fs_private;
-    int size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
-    int cluster_to_use = fat16_get_cluster_for_offset(disk, cluster, offset);
-    int res = 0;
+    struct fat_extent *extents;
+    int total;
 
-    if (cluster_to_use < 0) {
-        res = cluster_to_use;
-        goto out;
+    total = fat16_walk_extents(disk, cluster, NULL);
+    if (total < 0)
+        return total;
+
+    extents = kzalloc(total * sizeof(struct fat_extent));
+    if (!extents)
+        return -ENOMEM;
+
+    total = fat16_walk_extents(disk, cluster, extents);
+    if (total < 0) {
+        kfree(extents);
+        return total;
     }
 
-    int offset_from_cluster = offset % size_of_cluster_bytes;
-    int starting_sector = fat16_cluster_to_sector(private, cluster_to_use);
-    int starting_pos = (starting_sector * disk->sector_size) + offset_from_cluster;
-    int total_to_read = total > size_of_cluster_bytes ? size_of_cluster_bytes : total;
+    map->extents = extents;
+    map->total = total;
+    return 0;
+}
 
-    res = dstreamer_seek(stream, starting_pos);
-    if (res != PEACHOS_ALL_OK)
-        goto out;
+/* Binary search of the extent holding cluster "index" of the file */
+static int fat16_extent_map_find(struct fat_extent_map *map, uint32_t index)
+{
+    int low = 0;
+    int high = map->total - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        struct fat_extent *extent = &map->extents[mid];
+
+        if (index < extent->file_cluster)
+            high = mid - 1;
+        else if (index >= extent->file_cluster + extent->length)
+            low = mid + 1;
+        else
+            return mid;
+    }
 
-    res = dstreamer_read(stream, out, total_to_read);
-    if (res != PEACHOS_ALL_OK)
-        goto out;
+    return -EIO;
+}
 
-    total -= total_to_read;
-    if (total > 0) {
-        // We still have more to read
-        res = fat16_read_internal_from_stream(disk, stream, cluster, offset + total_to_read, total, out + total_to_read);
+/* Length of the run of consecutive clusters from "cluster", returns the cluster after it or 0 */
+static int fat16_get_chain_run(struct disk *disk, int cluster, uint32_t *length)
+{
+    int next;
+
+    *length = 1;
+    while ((next = fat16_get_next_cluster(disk, cluster)) == cluster + 1) {
+        (*length)++;
+        cluster = next;
     }
-out:
-    return res;
+
+    return next;
 }
 
-static int fat16_read_internal(struct disk *disk, int starting_cluster, int offset, int total, void *out)
+/*
+ * Each run of consecutive clusters is read with a single seek and read of
+ * the stream, straight into "out". The runs come from the extent map of the
+ * file if there is one, otherwise from the chain starting at "cluster".
+ */
+static int fat16_read_internal_from_stream(struct disk *disk, struct disk_stream *stream,
+                                           struct fat_extent_map *map, int cluster,
+                                           int offset, int total, void *out)
 {
-    struct fat_private *fs_private = disk->fs_private;
-    struct disk_stream *stream = fs_private->cluster_read_stream;
+    struct fat_private *private = disk->fs_private;
+    uint32_t size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
+    uint32_t index = offset / size_of_cluster_bytes;
+    uint32_t offset_in_run = offset % size_of_cluster_bytes;
+    uint32_t run_cluster;
+    uint32_t run_length;
+    int extent = 0;
+    int next = 0;
+    int res;
+
+    // The first run can start in the middle of an extent or of the chain
+    if (map) {
+        extent = fat16_extent_map_find(map, index);
+        if (extent < 0)
+            return extent;
+
+        run_cluster = map->extents[extent].cluster + (index - map->extents[extent].file_cluster);
+        run_length = map->extents[extent].length - (index - map->extents[extent].file_cluster);
+    } else {
+        res = fat16_get_cluster_for_offset(disk, cluster, offset);
+        if (res < 0)
+            return res;
+
+        run_cluster = res;
+        next = fat16_get_chain_run(disk, run_cluster, &run_length);
+        if (next < 0)
+            return next;
+    }
+
+    while (true) {
+        uint32_t total_to_read = (run_length * size_of_cluster_bytes) - offset_in_run;
+        int starting_pos;
+
+        if (total_to_read > total)
+            total_to_read = total;
+
+        starting_pos = (fat16_cluster_to_sector(private, run_cluster) * disk->sector_size) + offset_in_run;
+
+        res = dstreamer_seek(stream, starting_pos);
+        if (res != PEACHOS_ALL_OK)
+            return res;
 
-    return fat16_read_internal_from_stream(disk, stream, starting_cluster, offset, total, out);
+        res = dstreamer_read(stream, out, total_to_read);
+        if (res != PEACHOS_ALL_OK)
+            return res;
+
+        fat16_stats.stream_reads++;
+        out += total_to_read;
+        total -= total_to_read;
+        offset_in_run = 0;
+
+        if (total == 0)
+            return 0;
+
+        // We still have more to read, from the next run
+        if (map) {
+            if (++extent >= map->total)
+                return -EIO;
+
+            run_cluster = map->extents[extent].cluster;
+            run_length = map->extents[extent].length;
+        } else {
+            if (next == 0)
+                return -EIO;
+
+            run_cluster = next;
+            next = fat16_get_chain_run(disk, run_cluster, &run_length);
+            if (next < 0)
+                return next;
+        }
+    }
 }
 
 void fat16_free_directory(struct fat_directory *directory)
@@ -457,7 +756,7 @@ void fat16_free_directory(struct fat_directory *directory)
     if (directory->item)
         kfree(directory->item);
 
-    kfree(directory);
+    kmem_cache_free(fat_directory_cache, directory);
 }
 
 void fat16_fat_item_free(struct fat_item *item)
@@ -470,58 +769,88 @@ void fat16_fat_item_free(struct fat_item *item)
     else if (item->type == FAT_ITEM_TYPE_FILE)
         kfree(item->item);
 
-    kfree(item);
+    kmem_cache_free(fat_item_cache, item);
 }
 
-struct fat_directory *fat16_load_fat_directory(struct disk *disk, struct fat_directory_item *item)
+/* Read the directory a cluster at a time, following its chain */
+static struct fat_directory *fat16_load_fat_directory_at(struct disk *disk, int cluster)
 {
-    struct fat_directory *directory;
+    struct fat_directory *directory = NULL;
+    struct fat_directory_item *chunk = NULL;
     struct fat_private *fat_private;
-    int cluster_sector;
-    int cluster;
-    int total_items;
-    int directory_size;
+    struct disk_stream *stream;
+    int cluster_size;
+    int capacity = 0;
+    bool end = false;
     int res = 0;
 
-    if (!(item->attribute & FAT_FILE_SUBDIRECTORY)) {
-        res = -EINVARG;
-        goto out;
-    }
+    fat_private = disk->fs_private;
+    stream = fat_private->cluster_read_stream;
+    cluster_size = fat_private->header.primary_header.sectors_per_cluster * disk->sector_size;
 
-    directory = kzalloc(sizeof(struct fat_directory));
-    if (!directory) {
+    directory = kmem_cache_zalloc(fat_directory_cache);
+    chunk = kmalloc(cluster_size);
+    if (!directory || !chunk) {
         res = -ENOMEM;
         goto out;
     }
 
-    fat_private = disk->fs_private;
-    cluster = fat16_get_first_cluster(item);
-    cluster_sector = fat16_cluster_to_sector(fat_private, cluster);
-    total_items = fat16_get_total_items_for_directory(disk, cluster_sector);
-    directory->total = total_items;
-    directory_size = directory->total * sizeof(struct fat_directory_item);
-    directory->item = kzalloc(directory_size);
-    if (!directory->item) {
-        res = -ENOMEM;
-        goto out;
+    while (!end) {
+        int sector = fat16_cluster_to_sector(fat_private, cluster);
+
+        if (dstreamer_seek(stream, fat16_sector_to_absolute(disk, sector)) != PEACHOS_ALL_OK ||
+            dstreamer_read(stream, chunk, cluster_size) != PEACHOS_ALL_OK) {
+            res = -EIO;
+            goto out;
+        }
+        fat16_stats.directory_reads++;
+
+        res = fat16_directory_add_items(directory, &capacity, chunk,
+                                        cluster_size / sizeof(struct fat_directory_item), &end);
+        if (res < 0)
+            goto out;
+
+        if (end)
+            break;
+
+        cluster = fat16_get_next_cluster(disk, cluster);
+        if (cluster < 0) {
+            res = cluster;
+            goto out;
+        }
+
+        // A full directory has no terminating item
+        if (cluster == 0)
+            break;
     }
 
-    res = fat16_read_internal(disk, cluster, 0x00, directory_size, directory->item);
-    if (res != PEACHOS_ALL_OK)
-        goto out;
+    fat16_sort_directory(directory);
 
 out:
-    if (res != PEACHOS_ALL_OK)
+    if (chunk)
+        kfree(chunk);
+
+    if (res < 0) {
         fat16_free_directory(directory);
+        directory = NULL;
+    }
 
     return directory;
 }
 
+struct fat_directory *fat16_load_fat_directory(struct disk *disk, struct fat_directory_item *item)
+{
+    if (!(item->attribute & FAT_FILE_SUBDIRECTORY))
+        return NULL;
+
+    return fat16_load_fat_directory_at(disk, fat16_get_first_cluster(item));
+}
+
 struct fat_item *fat16_new_fat_item_for_directory_item(struct disk *disk, struct fat_directory_item *item)
 {
     struct fat_item *f_item;
 
-    f_item = kzalloc(sizeof(struct fat_item));
+    f_item = kmem_cache_zalloc(fat_item_cache);
     if (!f_item)
         return NULL;
 
@@ -538,48 +867,127 @@ out:
     return f_item;
 }
 
-struct fat_item *fat16_find_item_in_directory(struct disk *disk, struct fat_directory *directory, const char *name)
+/* "name.ext" to the space padded 8.3 name of the directory items, false if it isn't one */
+static bool fat16_to_short_name(const char *name, uint8_t *out)
 {
-    struct fat_item *f_item = NULL;
-    char tmp_filename[PEACHOS_MAX_PATH];
+    const char *dot = NULL;
+    int base_len;
+    int ext_len = 0;
+
+    memset(out, 0x20, FAT_SHORT_NAME_SIZE);
 
-    for (int i = 0; i < directory->total; i++) {
-        fat16_get_full_relative_filename(&directory->item[i], tmp_filename, sizeof(tmp_filename));
-        // Create a new fat item if we found it
-        if (istrncmp(tmp_filename, name, sizeof(tmp_filename)) == 0 )
-            f_item = fat16_new_fat_item_for_directory_item(disk, &directory->item[i]);
+    if (strncmp(name, ".", 2) == 0 || strncmp(name, "..", 3) == 0) {
+        memcpy(out, (void *) name, strlen(name));
+        return true;
     }
 
-    return f_item;
+    for (const char *p = name; *p; p++) {
+        if (*p == '.')
+            dot = p;
+    }
+
+    base_len = dot ? dot - name : strlen(name);
+    if (dot)
+        ext_len = strlen(dot + 1);
+
+    if (base_len == 0 || base_len > 8 || ext_len > 3)
+        return false;
+
+    memcpy(out, (void *) name, base_len);
+    if (dot)
+        memcpy(out + 8, (void *) (dot + 1), ext_len);
+
+    return true;
 }
 
-struct fat_item *fat16_get_directory_entry(struct disk *disk, struct path_part *path)
+/* Binary search of the sorted directory, NULL if there is no item named "name" */
+struct fat_directory_item *fat16_find_item_in_directory(struct fat_directory *directory, const char *name)
 {
-    struct fat_private *fat_private;
-    struct fat_item *current_item = NULL;
-    struct fat_item *root_item;
-    struct path_part *next_part;
+    uint8_t short_name[FAT_SHORT_NAME_SIZE];
+    int low = 0;
+    int high = directory->total - 1;
 
-    fat_private = disk->fs_private;
-    root_item = fat16_find_item_in_directory(disk, &fat_private->root_directory, path->part);
-    if (!root_item)
+    if (!fat16_to_short_name(name, short_name))
         return NULL;
 
-    next_part = path->next;
-    current_item = root_item;
-    while (next_part != 0) {
-        struct fat_item *tmp_item;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int cmp = fat16_compare_names(directory->item[middle].filename, short_name);
+
+        if (cmp == 0)
+            return &directory->item[middle];
+
+        if (cmp < 0)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+
+    return NULL;
+}
+
+/*
+ * Look up "name" in the directory starting at the cluster "parent", 0 is the
+ * root directory. The directory is only read when the directory entry cache
+ * doesn't know the name yet.
+ */
+static int fat16_lookup(struct disk *disk, uint32_t parent, const char *name, struct fat_directory_item *out)
+{
+    struct fat_private *fat_private = disk->fs_private;
+    struct fat_directory *directory;
+    struct fat_directory_item *item;
+    struct dentry *dentry;
+
+    dentry = dcache_lookup(disk, parent, name);
+    if (dentry) {
+        if (dentry->negative)
+            return -EBADPATH;
+
+        memcpy(out, dentry->data, sizeof(struct fat_directory_item));
+        return 0;
+    }
+
+    directory = &fat_private->root_directory;
+    if (parent != 0) {
+        directory = fat16_load_fat_directory_at(disk, parent);
+        if (!directory)
+            return -EIO;
+    }
+
+    item = fat16_find_item_in_directory(directory, name);
+    if (item) {
+        memcpy(out, item, sizeof(struct fat_directory_item));
+        dcache_add(disk, parent, name, item, sizeof(struct fat_directory_item));
+    } else {
+        dcache_add(disk, parent, name, NULL, 0);
+    }
+
+    if (directory != &fat_private->root_directory)
+        fat16_free_directory(directory);
+
+    return item ? 0 : -EBADPATH;
+}
+
+struct fat_item *fat16_get_directory_entry(struct disk *disk, struct path_part *path)
+{
+    struct fat_directory_item item;
+    uint32_t parent = 0;
+
+    while (1) {
+        if (fat16_lookup(disk, parent, path->part, &item) < 0)
+            return NULL;
+
+        if (!path->next)
+            break;
 
-        if (current_item->type != FAT_ITEM_TYPE_DIRECTORY)
+        if (!(item.attribute & FAT_FILE_SUBDIRECTORY))
             return NULL;
 
-        tmp_item = fat16_find_item_in_directory(disk, current_item->directory, next_part->part);
-        fat16_fat_item_free(current_item);
-        current_item = tmp_item;
-        next_part = next_part->next;
+        parent = fat16_get_first_cluster(&item);
+        path = path->next;
     }
 
-    return current_item;
+    return fat16_new_fat_item_for_directory_item(disk, &item);
 }
 
 void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode)
@@ -590,11 +998,19 @@ void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode)
     if (mode != FILE_MODE_READ)
         return ERROR(-ERDONLY);
 
-    descriptor = kzalloc(sizeof(struct fat_file_descriptor));
+    descriptor = kmem_cache_zalloc(fat_file_descriptor_cache);
     if (!descriptor)
         return ERROR(-ENOMEM);
 
+    descriptor->stream = dstreamer_new(disk->id);
+    if (!descriptor->stream) {
+        err_code = -ENOMEM;
+        goto out_free;
+    }
+
+    task_lock(&fat16_lock);
     descriptor->item = fat16_get_directory_entry(disk, path);
+    task_unlock(&fat16_lock);
     if (!descriptor->item) {
         err_code = -EIO;
         goto out_free;
@@ -604,14 +1020,19 @@ void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode)
     return descriptor;
 
 out_free:
-    kfree(descriptor);
+    if (descriptor->stream)
+        dstreamer_close(descriptor->stream);
+    kmem_cache_free(fat_file_descriptor_cache, descriptor);
     return ERROR(err_code);
 }
 
 static void fat16_free_file_descriptor(struct fat_file_descriptor *desc)
 {
     fat16_fat_item_free(desc->item);
-    kfree(desc);
+    dstreamer_close(desc->stream);
+    if (desc->map.extents)
+        kfree(desc->map.extents);
+    kmem_cache_free(fat_file_descriptor_cache, desc);
 }
 
 int fat16_close(void *private)
@@ -639,21 +1060,37 @@ int fat16_stat(struct disk *disk, void *private, struct file_stat *stat)
     return 0;
 }
 
+/* Whole items up to the end of the file are read at once, from the file position */
 int fat16_read(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmemb, char *out_ptr)
 {
     struct fat_file_descriptor *fat_desc = descriptor;
-    struct fat_directory_item *item = fat_desc->item->item;
-    int offset = fat_desc->pos;
+    struct fat_directory_item *item;
+    uint32_t left;
     int res;
 
-    for (uint32_t i = 0; i < nmemb; i++) {
-        res = fat16_read_internal(disk, fat16_get_first_cluster(item), offset, size, out_ptr);
-        if (ISERR(res))
+    if (fat_desc->item->type != FAT_ITEM_TYPE_FILE)
+        return -EINVARG;
+
+    item = fat_desc->item->item;
+    left = fat_desc->pos < item->filesize ? item->filesize - fat_desc->pos : 0;
+    if (nmemb > left / size)
+        nmemb = left / size;
+
+    if (nmemb == 0)
+        return 0;
+
+    if (!fat_desc->map.extents) {
+        res = fat16_build_extent_map(disk, fat16_get_first_cluster(item), &fat_desc->map);
+        if (res < 0)
             return res;
-        out_ptr += size;
-        offset += size;
     }
 
+    res = fat16_read_internal_from_stream(disk, fat_desc->stream, &fat_desc->map, fat16_get_first_cluster(item),
+                                          fat_desc->pos, size * nmemb, out_ptr);
+    if (ISERR(res))
+        return res;
+
+    fat_desc->pos += size * nmemb;
     return nmemb;
 }
 
@@ -684,4 +1121,248 @@ int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode)
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Split the extents of a map into runs of alternately one and run_length
+ * clusters. A run_length of one gives an extent per cluster, as if no two
+ * clusters of the file were consecutive.
+ */
+static int fat16_selftest_fragment(struct fat_extent_map *map, uint32_t run_length)
+{
+    struct fat_extent *extents;
+    uint32_t clusters = 0;
+    uint32_t length = 1;
+    int total = 0;
+
+    for (int i = 0; i < map->total; i++)
+        clusters += map->extents[i].length;
+
+    extents = kzalloc(clusters * sizeof(struct fat_extent));
+    if (!extents)
+        return -ENOMEM;
+
+    for (int i = 0; i < map->total; i++) {
+        uint32_t j = 0;
+
+        while (j < map->extents[i].length) {
+            extents[total].file_cluster = map->extents[i].file_cluster + j;
+            extents[total].cluster = map->extents[i].cluster + j;
+            extents[total].length = length;
+            if (extents[total].length > map->extents[i].length - j)
+                extents[total].length = map->extents[i].length - j;
+
+            j += extents[total].length;
+            total++;
+            length = (length == 1) ? run_length : 1;
+        }
+    }
+
+    kfree(map->extents);
+    map->extents = extents;
+    map->total = total;
+    return 0;
+}
+
+/*
+ * Read the whole file with a stream of its own, as the program loader does.
+ * A run_length other than zero splits its extents first.
+ */
+static int fat16_selftest_read(struct disk *disk, struct fat_directory_item *item, void *out, uint32_t run_length)
+{
+    struct fat_extent_map map;
+    struct disk_stream *stream;
+    int res;
+
+    res = fat16_build_extent_map(disk, fat16_get_first_cluster(item), &map);
+    if (res < 0)
+        return res;
+
+    if (run_length) {
+        res = fat16_selftest_fragment(&map, run_length);
+        if (res < 0) {
+            kfree(map.extents);
+            return res;
+        }
+    }
+
+    stream = dstreamer_new(disk->id);
+    if (!stream) {
+        kfree(map.extents);
+        return -ENOMEM;
+    }
+
+    res = fat16_read_internal_from_stream(disk, stream, &map, fat16_get_first_cluster(item),
+                                          0, item->filesize, out);
+
+    dstreamer_close(stream);
+    kfree(map.extents);
+    return res;
+}
+
+/*
+ * Look a name up repeatedly, and a name that doesn't exist, and report the
+ * hits of the directory entry cache and the disk commands they took.
+ */
+static void fat16_selftest_lookups(struct disk *disk)
+{
+    struct fat_directory_item item;
+    struct dcache_stat dcache_before;
+    struct dcache_stat dcache_after;
+    struct disk_stat before;
+    struct disk_stat after;
+
+    dcache_get_stats(&dcache_before);
+    disk_get_stats(&before);
+
+    task_lock(&fat16_lock);
+    for (int i = 0; i < FAT16_SELFTEST_LOOKUPS; i++) {
+        fat16_lookup(disk, 0, "shell.elf", &item);
+        fat16_lookup(disk, 0, "missing.txt", &item);
+    }
+    task_unlock(&fat16_lock);
+
+    dcache_get_stats(&dcache_after);
+    disk_get_stats(&after);
+
+    print("dcache: ");
+    print_number(dcache_after.hits - dcache_before.hits);
+    print(" of ");
+    print_number(2 * FAT16_SELFTEST_LOOKUPS);
+    print(" lookups hit (");
+    print_number(dcache_after.negative_hits - dcache_before.negative_hits);
+    print(" negative) with ");
+    print_number(after.commands - before.commands);
+    print(" disk commands\n");
+}
+
+/*
+ * Load the root directory again and report the stream reads and the disk
+ * commands it took, the items are read a chunk at a time in a single pass.
+ */
+static void fat16_selftest_directory(struct disk *disk)
+{
+    struct fat_directory directory;
+    struct disk_stat before;
+    struct disk_stat after;
+    uint32_t reads;
+    int res;
+
+    disk_get_stats(&before);
+    reads = fat16_stats.directory_reads;
+
+    task_lock(&fat16_lock);
+    res = fat16_get_root_directory(disk, disk->fs_private, &directory);
+    task_unlock(&fat16_lock);
+
+    reads = fat16_stats.directory_reads - reads;
+    disk_get_stats(&after);
+
+    if (res < 0) {
+        print("fat16: loading the root directory FAILED\n");
+        return;
+    }
+
+    print("fat16: root directory of ");
+    print_number(directory.total);
+    print(" items loaded with ");
+    print_number(reads);
+    print(" stream reads and ");
+    print_number(after.commands - before.commands);
+    print(" disk commands\n");
+
+    if (directory.item)
+        kfree(directory.item);
+}
+
+/*
+ * Read FAT16_SELFTEST_FILE and report the disk commands and the FAT lookups
+ * it took. Each lookup is served from the FAT kept in memory, it used to be
+ * a read of the FAT through the buffer cache. The file is read again with
+ * single cluster extents mixed with runs of FAT16_SELFTEST_RUN_LENGTH, then
+ * with an extent per cluster. The data must be the same and each split must
+ * take more stream reads, which shows what the runs of consecutive clusters
+ * save.
+ */
+void fat16_selftest(struct disk *disk)
+{
+    struct fat_directory_item item;
+    struct disk_stat before;
+    struct disk_stat after;
+    uint32_t fragmented_reads = 0;
+    uint32_t mixed_reads = 0;
+    uint32_t stream_reads = 0;
+    uint32_t lookups;
+    char *buf = NULL;
+    int res;
+
+    if (disk->filesystem != &fat16_fs)
+        return;
+
+    disk_get_stats(&before);
+    after = before;
+    lookups = fat16_stats.fat_lookups;
+
+    task_lock(&fat16_lock);
+    res = fat16_lookup(disk, 0, FAT16_SELFTEST_FILE, &item);
+    task_unlock(&fat16_lock);
+    if (res < 0)
+        goto out;
+
+    buf = kmalloc(3 * item.filesize);
+    if (!buf) {
+        res = -ENOMEM;
+        goto out;
+    }
+
+    stream_reads = fat16_stats.stream_reads;
+    res = fat16_selftest_read(disk, &item, buf, 0);
+    stream_reads = fat16_stats.stream_reads - stream_reads;
+    lookups = fat16_stats.fat_lookups - lookups;
+    disk_get_stats(&after);
+    if (res < 0)
+        goto out;
+
+    mixed_reads = fat16_stats.stream_reads;
+    res = fat16_selftest_read(disk, &item, buf + item.filesize, FAT16_SELFTEST_RUN_LENGTH);
+    mixed_reads = fat16_stats.stream_reads - mixed_reads;
+    if (res < 0)
+        goto out;
+
+    fragmented_reads = fat16_stats.stream_reads;
+    res = fat16_selftest_read(disk, &item, buf + 2 * item.filesize, 1);
+    fragmented_reads = fat16_stats.stream_reads - fragmented_reads;
+    if (res < 0)
+        goto out;
+
+    if (memcmp(buf, buf + item.filesize, item.filesize) != 0 ||
+        memcmp(buf, buf + 2 * item.filesize, item.filesize) != 0)
+        res = -EIO;
+
+    // A file of several clusters must save stream reads on each run it keeps
+    if (stream_reads > mixed_reads || mixed_reads >= fragmented_reads)
+        res = -EIO;
+
+out:
+    if (res < 0) {
+        print("fat16: reading " FAT16_SELFTEST_FILE " FAILED\n");
+    } else {
+        print("fat16: " FAT16_SELFTEST_FILE " ");
+        print_number(after.commands - before.commands);
+        print(" commands ");
+        print_number(lookups);
+        print(" FAT lookups, ");
+        print_number(stream_reads);
+        print(" stream reads, ");
+        print_number(mixed_reads);
+        print(" mixed, ");
+        print_number(fragmented_reads);
+        print(" split\n");
+    }
+
+    if (buf)
+        kfree(buf);
+
+    fat16_selftest_lookups(disk);
+    fat16_selftest_directory(disk);
+}
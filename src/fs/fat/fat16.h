@@ -7,8 +7,13 @@
 #ifndef FAT16_H
 #define FAT16_H
 
-#include "file.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fs/file.h"
 
 struct filesystem *fat16_init(void);
+bool fat16_is_free_sector(struct disk *disk, uint32_t lba);
+void fat16_selftest(struct disk *disk);
 
 #endif // FAT16_H
\ No newline at end of file
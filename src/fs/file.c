@@ -9,8 +9,10 @@
 #include "memory/memory.h"
 #include "status.h"
 #include "memory/heap/kheap.h"
+#include "memory/slab/slab.h"
 #include "kernel.h"
 #include "fs/fat/fat16.h"
+#include "fs/dcache.h"
 #include "disk/disk.h"
 #include "string/string.h"
 #include "kernel.h"
@@ -18,6 +20,8 @@
 struct filesystem *filesystems[PEACHOS_MAX_FILESYSTEMS];
 struct file_descriptor *file_descriptors[PEACHOS_MAX_FILE_DESCRIPTORS];
 
+static struct kmem_cache *file_descriptor_cache;
+
 static struct filesystem **fs_get_free_filesystem(void)
 {
     for (int i = 0; i < PEACHOS_MAX_FILESYSTEMS; i++)
@@ -56,20 +60,30 @@ void fs_load(void)
 void fs_init(void)
 {
     memset(file_descriptors, 0, sizeof(file_descriptors));
+
+    file_descriptor_cache = kmem_cache_create("file_descriptor", sizeof(struct file_descriptor), NULL);
+    if (!file_descriptor_cache)
+        panic("Failed to create the file descriptor cache\n");
+
+    pparser_init();
+    dcache_init();
     fs_load();
 }
 
 static void file_free_descriptor(struct file_descriptor *desc)
 {
     file_descriptors[desc->index - 1] = 0x00;
-    kfree(desc);
+    kmem_cache_free(file_descriptor_cache, desc);
 }
 
 static int file_new_descriptor(struct file_descriptor **desc_out)
 {
     for (int i = 0; i < PEACHOS_MAX_FILE_DESCRIPTORS; i++) {
         if (file_descriptors[i] == 0) {
-            struct file_descriptor *desc = kzalloc(sizeof(struct file_descriptor));
+            struct file_descriptor *desc = kmem_cache_zalloc(file_descriptor_cache);
+            if (!desc)
+                return -ENOMEM;
+
             // Descriptors start at 1
             desc->index = i + 1;
             file_descriptors[i] = desc;
@@ -183,11 +197,14 @@ out:
 int fstat(int fd, struct file_stat *stat)
 {
     struct file_descriptor *desc = file_get_descriptor(fd);
+    int res;
 
     if (!desc)
         return -EIO;
 
-    return desc->filesystem->stat(desc->disk, desc->private, stat);
+    res = desc->filesystem->stat(desc->disk, desc->private, stat);
+
+    return res;
 }
 
 int fclose(int fd)
@@ -208,16 +225,20 @@ int fclose(int fd)
 int fseek(int fd, int offset, FILE_SEEK_MODE whence)
 {
     struct file_descriptor *desc = file_get_descriptor(fd);
+    int res;
 
-    if (!fd)
+    if (!desc)
         return -EIO;
 
-    return desc->filesystem->seek(desc->private, offset, whence);
+    res = desc->filesystem->seek(desc->private, offset, whence);
+
+    return res;
 }
 
 int fread(void *ptr, uint32_t size, uint32_t nmemb, int fd)
 {
     struct file_descriptor *desc;
+    int res;
 
     if (size == 0 || nmemb == 0 || fd < 1)
         return -EINVARG;
@@ -226,5 +247,7 @@ int fread(void *ptr, uint32_t size, uint32_t nmemb, int fd)
     if (!desc)
         return -EINVARG;
 
-    return desc->filesystem->read(desc->disk, desc->private, size, nmemb, (char *) ptr);
+    res = desc->filesystem->read(desc->disk, desc->private, size, nmemb, (char *) ptr);
+
+    return res;
 }
\ No newline at end of file
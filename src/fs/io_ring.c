@@ -0,0 +1,215 @@
+/*
+ * I/O rings
+ *
+ * A program queues open, read and close requests in a submission ring it
+ * shares with the kernel. A single syscall runs a batch of them and their
+ * results are posted to the completion ring, where the program reaps them
+ * without a syscall.
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#include "io_ring.h"
+#include "file.h"
+#include "status.h"
+#include "kernel.h"
+#include "task/task.h"
+#include "task/process.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+#include "memory/frame/frame.h"
+#include "memory/paging/paging.h"
+
+// Reads go through a kernel buffer of this size before being copied to the program
+#define IO_RING_READ_CHUNK 4096
+
+/* The ring is identity mapped, the kernel uses it from any address space */
+struct io_ring *io_ring_setup(struct process *process)
+{
+    struct io_ring *ring;
+    int res;
+
+    if (process->io_ring)
+        return ERROR(-EINVARG);
+
+    ring = frame_zalloc(frame_count(sizeof(struct io_ring)));
+    if (!ring)
+        return ERROR(-ENOMEM);
+
+    res = paging_map_to(process->task->page_directory,
+                        ring,
+                        ring,
+                        paging_align_address((void *) ring + sizeof(struct io_ring)),
+                        PAGING_IS_WRITEABLE | PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL);
+    if (res < 0) {
+        frame_free(ring, frame_count(sizeof(struct io_ring)));
+        return ERROR(res);
+    }
+
+    process->io_ring = ring;
+    return ring;
+}
+
+/* Slot of "fd" in the files of the process, a free slot for 0 */
+static int io_ring_find_file(struct process *process, int fd)
+{
+    if (fd < 0)
+        return -EINVARG;
+
+    for (int i = 0; i < PEACHOS_MAX_PROCESS_FILES; i++) {
+        if (process->files[i] == fd)
+            return i;
+    }
+
+    return fd == 0 ? -ENOMEM : -EINVARG;
+}
+
+static int io_ring_open(struct process *process, struct io_ring_sqe *sqe)
+{
+    char filename[PEACHOS_MAX_PATH];
+    int slot;
+    int res;
+    int fd;
+
+    slot = io_ring_find_file(process, 0);
+    if (slot < 0)
+        return slot;
+
+    res = strncpy_from_user(process->task, filename, (void *) sqe->addr, sizeof(filename));
+    if (res < 0)
+        return res;
+
+    // The filesystems are read-only
+    fd = fopen(filename, "r");
+    if (fd <= 0)
+        return -EIO;
+
+    process->files[slot] = fd;
+    return fd;
+}
+
+static int io_ring_read(struct process *process, struct io_ring_sqe *sqe)
+{
+    uint32_t done = 0;
+    char *buf;
+    int res = 0;
+
+    if (io_ring_find_file(process, sqe->fd) < 0)
+        return -EINVARG;
+
+    if (sqe->offset != IO_RING_OFFSET_CURRENT) {
+        res = fseek(sqe->fd, sqe->offset, SEEK_SET);
+        if (res < 0)
+            return res;
+    }
+
+    buf = kmalloc(IO_RING_READ_CHUNK);
+    if (!buf)
+        return -ENOMEM;
+
+    while (done < sqe->len) {
+        uint32_t chunk = sqe->len - done;
+        if (chunk > IO_RING_READ_CHUNK)
+            chunk = IO_RING_READ_CHUNK;
+
+        res = fread(buf, 1, chunk, sqe->fd);
+        if (res <= 0)
+            break;
+
+        if (copy_to_user(process->task, (void *) (sqe->addr + done), buf, res) < 0) {
+            res = -EFAULT;
+            break;
+        }
+
+        done += res;
+
+        // End of the file
+        if (res < chunk)
+            break;
+    }
+
+    kfree(buf);
+    return res < 0 ? res : done;
+}
+
+static int io_ring_close(struct process *process, struct io_ring_sqe *sqe)
+{
+    int slot = io_ring_find_file(process, sqe->fd);
+    int res;
+
+    if (slot < 0 || sqe->fd == 0)
+        return -EINVARG;
+
+    res = fclose(sqe->fd);
+    if (res == 0)
+        process->files[slot] = 0;
+
+    return res;
+}
+
+static int io_ring_run(struct process *process, struct io_ring_sqe *sqe)
+{
+    switch (sqe->opcode) {
+    case IO_RING_OP_NOP:
+        return 0;
+    case IO_RING_OP_OPEN:
+        return io_ring_open(process, sqe);
+    case IO_RING_OP_READ:
+        return io_ring_read(process, sqe);
+    case IO_RING_OP_CLOSE:
+        return io_ring_close(process, sqe);
+    }
+
+    return -EINVARG;
+}
+
+/*
+ * Run up to "to_submit" queued requests in order, posting their completions.
+ * It stops early when the completion ring is full, the number of requests
+ * taken off the submission ring is returned.
+ */
+int io_ring_enter(struct process *process, uint32_t to_submit)
+{
+    struct io_ring *ring = process->io_ring;
+    uint32_t submitted = 0;
+
+    if (!ring)
+        return -EINVARG;
+
+    while (submitted < to_submit && ring->sq_head != ring->sq_tail) {
+        struct io_ring_sqe sqe;
+        struct io_ring_cqe *cqe;
+
+        if (ring->cq_tail - ring->cq_head >= PEACHOS_IO_RING_ENTRIES)
+            break;
+
+        // The program can change the slot, work on a copy
+        memcpy(&sqe, (void *) &ring->sqes[ring->sq_head % PEACHOS_IO_RING_ENTRIES], sizeof(sqe));
+        ring->sq_head++;
+
+        cqe = &ring->cqes[ring->cq_tail % PEACHOS_IO_RING_ENTRIES];
+        cqe->res = io_ring_run(process, &sqe);
+        cqe->user_data = sqe.user_data;
+        ring->cq_tail++;
+
+        submitted++;
+    }
+
+    return submitted;
+}
+
+/* Close the files left open and free the ring, the process is going away */
+void io_ring_release(struct process *process)
+{
+    for (int i = 0; i < PEACHOS_MAX_PROCESS_FILES; i++) {
+        if (process->files[i]) {
+            fclose(process->files[i]);
+            process->files[i] = 0;
+        }
+    }
+
+    if (process->io_ring) {
+        frame_free(process->io_ring, frame_count(sizeof(struct io_ring)));
+        process->io_ring = NULL;
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * I/O rings
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+#define IO_RING_OP_NOP 0
+#define IO_RING_OP_OPEN 1
+#define IO_RING_OP_READ 2
+#define IO_RING_OP_CLOSE 3
+
+// Read from the current position of the file
+#define IO_RING_OFFSET_CURRENT 0xFFFFFFFF
+
+struct io_ring_sqe {
+    uint32_t opcode;
+    int32_t fd;             // read, close
+    uint32_t addr;          // open: file name, read: buffer
+    uint32_t len;           // read: bytes
+    uint32_t offset;        // read: file position or IO_RING_OFFSET_CURRENT
+    uint32_t user_data;     // copied to the completion
+};
+
+struct io_ring_cqe {
+    uint32_t user_data;
+    int32_t res;            // open: fd, read: bytes read, or a negative error
+};
+
+/*
+ * Shared with the program, that queues requests at sq_tail and reaps their
+ * completions at cq_head. The kernel moves sq_head and cq_tail. The indexes
+ * only grow, index "i" is slot i % PEACHOS_IO_RING_ENTRIES.
+ */
+struct io_ring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+
+    struct io_ring_sqe sqes[PEACHOS_IO_RING_ENTRIES];
+    struct io_ring_cqe cqes[PEACHOS_IO_RING_ENTRIES];
+};
+
+struct process;
+
+struct io_ring *io_ring_setup(struct process *process);
+int io_ring_enter(struct process *process, uint32_t to_submit);
+void io_ring_release(struct process *process);
+
+#endif // IO_RING_H
@@ -7,10 +7,26 @@
 #include "pparser.h"
 #include "string/string.h"
 #include "memory/heap/kheap.h"
+#include "memory/slab/slab.h"
 #include "memory/memory.h"
+#include "kernel.h"
 #include "status.h"
 #include "config.h"
 
+static struct kmem_cache *path_root_cache;
+static struct kmem_cache *path_part_cache;
+static struct kmem_cache *path_part_name_cache;
+
+void pparser_init(void)
+{
+    path_root_cache = kmem_cache_create("path_root", sizeof(struct path_root), NULL);
+    path_part_cache = kmem_cache_create("path_part", sizeof(struct path_part), NULL);
+    path_part_name_cache = kmem_cache_create("path_part_name", PEACHOS_MAX_PATH, NULL);
+
+    if (!path_root_cache || !path_part_cache || !path_part_name_cache)
+        panic("Failed to create the path parser caches\n");
+}
+
 static int pparser_path_valid_format(const char *filename)
 {
     int len = strnlen(filename, PEACHOS_MAX_PATH);
@@ -32,7 +48,10 @@ static int pparser_get_drive_by_path(const char **path)
 
 static struct path_root *pparser_create_root(int drive_number)
 {
-    struct path_root *path_r = kzalloc(sizeof(struct path_root));
+    struct path_root *path_r = kmem_cache_zalloc(path_root_cache);
+
+    if (!path_r)
+        return NULL;
 
     path_r->drive_number = drive_number;
     path_r->first = 0;
@@ -42,9 +61,12 @@ static struct path_root *pparser_create_root(int drive_number)
 
 static const char *pparser_get_path_part(const char **path)
 {
-    char *result_path_part = kzalloc(PEACHOS_MAX_PATH);
+    char *result_path_part = kmem_cache_zalloc(path_part_name_cache);
     int i = 0;
 
+    if (!result_path_part)
+        return NULL;
+
     while(**path != '/' && **path != 0x00) {
         result_path_part[i] = **path;
         *path += 1;
@@ -56,7 +78,7 @@ static const char *pparser_get_path_part(const char **path)
         *path += 1;
     
     if (i == 0) {
-        kfree(result_path_part);
+        kmem_cache_free(path_part_name_cache, result_path_part);
         return NULL;
     }
 
@@ -70,7 +92,12 @@ static struct path_part *pparser_parse_path_part(struct path_part *last_part, co
     if (!path_part_str)
         return NULL;
 
-    struct path_part *part = kzalloc(sizeof(struct path_part));
+    struct path_part *part = kmem_cache_zalloc(path_part_cache);
+    if (!part) {
+        kmem_cache_free(path_part_name_cache, (void *) path_part_str);
+        return NULL;
+    }
+
     part->part = path_part_str;
     part->next = 0x00;
 
@@ -86,12 +113,12 @@ void pparser_free(struct path_root *root)
 
     while (part) {
         struct path_part *next_part = part->next;
-        kfree((void *) part->part);
-        kfree(part);
+        kmem_cache_free(path_part_name_cache, (void *) part->part);
+        kmem_cache_free(path_part_cache, part);
         part = next_part;
     }
 
-    kfree(root);
+    kmem_cache_free(path_root_cache, root);
 }
 
 struct path_root * pparser_parse(const char *path, const char *current_directory_path)
@@ -17,6 +17,7 @@ struct path_part {
     struct path_part *next;
 };
 
+void pparser_init(void);
 struct path_root * pparser_parse(const char *path, const char *current_directory_path);
 void pparser_free(struct path_root *root);
 
@@ -7,13 +7,18 @@ section .asm
 extern int21h_handler
 extern no_interrupt_handler
 extern isr80h_handler
-extern interupt_handler
+extern isr80h_sysenter_handler
+extern interrupt_handler
 
 global idt_load
 global no_interrupt
 global enable_interrupts
 global disable_interrupts
 global isr80h_wrapper
+global isr80h_sysenter_wrapper
+global cpu_has_sysenter
+global sysenter_init
+global sysenter_set_stack
 global interrupt_pointer_table
 
 enable_interrupts:
@@ -55,7 +60,7 @@ no_interrupt:
     ; Interrupt frame end
     push esp
     push dword %1
-    call no_interrupt_handler
+    call interrupt_handler
     add esp, 8
     popad
     iret
@@ -95,6 +100,71 @@ isr80h_wrapper:
     mov eax, [tmp_res]
     iretd
 
+; Sysenter loads the kernel cs, ss, esp and eip from the MSRs, with
+; interrupts disabled. The user stack pointer is in ebp.
+isr80h_sysenter_wrapper:
+    ; Build the same frame as the processor pushes for int 0x80
+    push dword 0x23     ; ss, user data segment
+    push ebp            ; sp, the resume address is on top of it
+    pushfd              ; flags
+    push dword 0x1B     ; cs, user code segment
+    push dword 0        ; ip, read from the user stack by isr80h_sysenter_handler
+    pushad
+
+    push esp
+    push eax
+    call isr80h_sysenter_handler
+    add esp, 8
+    mov [esp+28], eax   ; Return the result in eax, it's restored by popad
+
+    popad
+    pop edx             ; ip, sysexit jumps to edx
+    add esp, 8          ; cs and flags
+    pop ecx             ; sp, sysexit loads esp from ecx
+    add esp, 4          ; ss
+
+    sti                 ; Takes effect after sysexit, in user land
+    sysexit
+
+; bool cpu_has_sysenter(void)
+cpu_has_sysenter:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov eax, 1
+    cpuid
+    mov eax, edx
+    shr eax, 11         ; CPUID.01h:EDX bit 11, sysenter and sysexit
+    and eax, 1
+    pop ebx
+    pop ebp
+    ret
+
+; void sysenter_init(uint32_t code_selector, void *entry)
+sysenter_init:
+    push ebp
+    mov ebp, esp
+    xor edx, edx
+    mov eax, [ebp+8]
+    mov ecx, 0x174      ; IA32_SYSENTER_CS, ss is cs + 8 and the user ones cs + 16 and cs + 24
+    wrmsr
+    mov eax, [ebp+12]
+    mov ecx, 0x176      ; IA32_SYSENTER_EIP
+    wrmsr
+    pop ebp
+    ret
+
+; void sysenter_set_stack(void *stack_top)
+sysenter_set_stack:
+    push ebp
+    mov ebp, esp
+    xor edx, edx
+    mov eax, [ebp+8]
+    mov ecx, 0x175      ; IA32_SYSENTER_ESP
+    wrmsr
+    pop ebp
+    ret
+
 section .data
 
 ; Inside here is stored the return result from isr80h_handlers
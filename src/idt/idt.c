@@ -4,6 +4,8 @@
  * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
  */
 
+#include <stdbool.h>
+
 #include "config.h"
 #include "idt/idt.h"
 #include "memory/memory.h"
@@ -12,6 +14,8 @@
 #include "task/task.h"
 #include "status.h"
 #include "task/process.h"
+#include "isr80h/isr80h.h"
+#include "disk/bcache.h"
 
 struct idt_desc idt_descriptors[PEACHOS_TOTAL_INTERRUPTS];
 struct idtr_desc idtr_descriptor;
@@ -24,6 +28,16 @@ static ISR80H_COMMAND isr80h_commands[PEACHOS_MAX_ISR80H_COMMANDS];
 extern void idt_load(void *idtr_desc);
 extern void no_interrupt(void);
 extern void isr80h_wrapper(void);
+extern void isr80h_sysenter_wrapper(void);
+extern bool cpu_has_sysenter(void);
+extern void sysenter_init(uint32_t code_selector, void *entry);
+extern void sysenter_set_stack(void *stack_top);
+
+// The CPU supports sysenter and its MSRs are set
+static bool sysenter_enabled = false;
+
+// Timer interrupts since the boot
+static volatile uint32_t idt_ticks;
 
 void no_interrupt_handler(void)
 {
@@ -31,16 +45,32 @@ void no_interrupt_handler(void)
 	outb(0x20, 0x20);
 }
 
+/* The interrupt came from user land, not from a task waiting in the kernel */
+static bool idt_frame_is_user(struct interrupt_frame *frame)
+{
+	return (frame->cs & 0x03) == 0x03;
+}
+
+/*
+ * The task page directories map the kernel memory too, so the handlers run
+ * on the directory of the interrupted task. Only the segment registers are
+ * switched.
+ */
 void interrupt_handler(int interrupt, struct interrupt_frame *frame)
 {
-	kernel_page();
+	kernel_registers();
 	if (interrupt_callbacks[interrupt] != 0) {
-		task_current_save_state(frame);
+		if (idt_frame_is_user(frame))
+			task_current_save_state(frame);
 		interrupt_callbacks[interrupt](frame);
 	}
-	task_page();
 
-	/* Send ACK to the PIC */
+	if (idt_frame_is_user(frame))
+		user_registers();
+
+	/* Send ACK to the PICs, IRQ 8-15 come through the slave */
+	if (interrupt >= 0x28 && interrupt < 0x30)
+		outb(0xA0, 0x20);
 	outb(0x20, 0x20);
 }
 
@@ -73,8 +103,14 @@ void idt_handle_exception()
 	task_next();
 }
 
-void idt_clock()
+void idt_clock(struct interrupt_frame *frame)
 {
+	idt_ticks++;
+
+	// Don't preempt a task waiting in the kernel, interrupt_handler sends the ACK
+	if (!idt_frame_is_user(frame))
+		return;
+
 	/* Send ACK to the PIC */
 	outb(0x20, 0x20);
 
@@ -104,6 +140,23 @@ void idt_init(void)
 
 	// Load the interrupt descriptor table
 	idt_load(&idtr_descriptor);
+
+	// Fast syscall entry, the stack is set per task in task_switch()
+	if (cpu_has_sysenter()) {
+		sysenter_init(KERNEL_CODE_SELECTOR, isr80h_sysenter_wrapper);
+		sysenter_enabled = true;
+	}
+}
+
+void isr80h_sysenter_set_stack(void *stack_top)
+{
+	if (sysenter_enabled)
+		sysenter_set_stack(stack_top);
+}
+
+uint32_t idt_get_ticks(void)
+{
+	return idt_ticks;
 }
 
 int idt_register_interrupt_callback(int interrupt, INTERRUPT_CALLBACK_FUNCTION interrupt_callback)
@@ -145,10 +198,38 @@ void *isr80h_handler(int command, struct interrupt_frame *frame)
 {
 	void *res = 0;
 
-	kernel_page();
+	/*
+	 * Stay on the task page directory, it maps the kernel memory too, and
+	 * the user memory can be accessed directly. Only the segment registers
+	 * need to be switched.
+	 */
+	kernel_registers();
 	task_current_save_state(frame);
-	res = isr80h_handle_command(command, frame);
-	task_page();
+
+	// Periodic write-back of the buffer cache, the task can sleep here
+	if (bcache_sync_due())
+		bcache_sync();
+
+	res = isr80h_handle_command(command & ~ISR80H_REGISTER_ARGUMENTS, frame);
+	user_registers();
 
 	return res;
-}
\ No newline at end of file
+}
+
+/*
+ * Syscalls entered with sysenter. The user stub saves its stack pointer in
+ * ebp, right below it is the address to resume at. The wrapper builds the
+ * same frame as int 0x80 and returns with sysexit.
+ */
+void *isr80h_sysenter_handler(int command, struct interrupt_frame *frame)
+{
+	uint32_t ip;
+
+	if (copy_from_user(task_current(), &ip, (void *) frame->esp, sizeof(ip)) < 0)
+		idt_handle_exception();
+
+	frame->ip = ip;
+	frame->esp += sizeof(ip);
+
+	return isr80h_handler(command, frame);
+}
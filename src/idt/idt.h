@@ -49,6 +49,8 @@ void idt_init(void);
 void enable_interrupts(void);
 void disable_interrupts(void);
 void isr80h_register_command(int command_id, ISR80H_COMMAND command);
+void isr80h_sysenter_set_stack(void *stack_top);
+uint32_t idt_get_ticks(void);
 int idt_register_interrupt_callback(int interrupt, INTERRUPT_CALLBACK_FUNCTION interrupt_callback);
 
 #endif // IDT_H
\ No newline at end of file
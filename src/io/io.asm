@@ -8,6 +8,11 @@ global insb
 global insw
 global outb
 global outw
+global insl
+global outl
+global rep_insw
+global rep_outsw
+global read_tsc
 
 ; unsigned char insb(unsigned short port)
 insb:
@@ -56,3 +61,69 @@ outw:
 
     pop ebp
     ret
+
+; uint32_t insl(unsigned short port)
+insl:
+    push ebp
+    mov ebp, esp
+
+    mov edx, [ebp+8]    ; edx = port
+    in eax, dx
+
+    pop ebp
+    ret
+
+; void outl(unsigned short port, uint32_t val)
+outl:
+    push ebp
+    mov ebp, esp
+
+    mov eax, [ebp+12]   ; eax = val
+    mov edx, [ebp+8]    ; edx = port
+    out dx, eax
+
+    pop ebp
+    ret
+
+; void rep_insw(unsigned short port, void *buf, uint32_t count)
+;
+; Read "count" words from the port into the buffer
+rep_insw:
+    push ebp
+    mov ebp, esp
+    push edi
+
+    mov edx, [ebp+8]    ; edx = port
+    mov edi, [ebp+12]   ; edi = buf
+    mov ecx, [ebp+16]   ; ecx = count
+    cld
+    rep insw
+
+    pop edi
+    pop ebp
+    ret
+
+; void rep_outsw(unsigned short port, const void *buf, uint32_t count)
+;
+; Write "count" words from the buffer to the port
+rep_outsw:
+    push ebp
+    mov ebp, esp
+    push esi
+
+    mov edx, [ebp+8]    ; edx = port
+    mov esi, [ebp+12]   ; esi = buf
+    mov ecx, [ebp+16]   ; ecx = count
+    cld
+    rep outsw
+
+    pop esi
+    pop ebp
+    ret
+
+; uint32_t read_tsc(void)
+;
+; Low 32 bits of the time stamp counter
+read_tsc:
+    rdtsc
+    ret
@@ -7,10 +7,20 @@
 #ifndef IO_H
 #define IO_H
 
+#include <stdint.h>
+
 unsigned char insb(unsigned short port);
 unsigned short insw(unsigned short port);
 
 void outb(unsigned short port, unsigned char val);
 void outw(unsigned short port, unsigned short val);
 
+uint32_t insl(unsigned short port);
+void outl(unsigned short port, uint32_t val);
+
+void rep_insw(unsigned short port, void *buf, uint32_t count);
+void rep_outsw(unsigned short port, const void *buf, uint32_t count);
+
+uint32_t read_tsc(void);
+
 #endif // IO_H
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "disk.h"
+#include "isr80h/isr80h.h"
+#include "task/task.h"
+#include "disk/bcache.h"
+#include "disk/bio.h"
+#include "status.h"
+#include "kernel.h"
+
+// Copy the buffer cache statistics to the user structure
+void *isr80h_command11_bcache_stats(struct interrupt_frame *frame)
+{
+    struct bcache_stat *stat_user_ptr = isr80h_get_argument(frame, 0);
+    struct bcache_stat stat;
+
+    bcache_get_stats(&stat);
+
+    if (copy_to_user(task_current(), stat_user_ptr, &stat, sizeof(stat)) < 0)
+        return ERROR(-EFAULT);
+
+    return 0;
+}
+
+// Write the cached disk writes to the disks
+void *isr80h_command14_sync(struct interrupt_frame *frame)
+{
+    return (void *) bcache_sync();
+}
+
+// Copy the request queue statistics to the user structure
+void *isr80h_command15_bio_stats(struct interrupt_frame *frame)
+{
+    struct bio_stat *stat_user_ptr = isr80h_get_argument(frame, 0);
+    struct bio_stat stat;
+
+    bio_get_stats(&stat);
+
+    if (copy_to_user(task_current(), stat_user_ptr, &stat, sizeof(stat)) < 0)
+        return ERROR(-EFAULT);
+
+    return 0;
+}
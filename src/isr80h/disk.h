@@ -0,0 +1,9 @@
+#ifndef ISR80H_DISK_H
+#define ISR80H_DISK_H
+
+struct interrupt_frame;
+void *isr80h_command11_bcache_stats(struct interrupt_frame *frame);
+void *isr80h_command14_sync(struct interrupt_frame *frame);
+void *isr80h_command15_bio_stats(struct interrupt_frame *frame);
+
+#endif // ISR80H_DISK_H
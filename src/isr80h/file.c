@@ -0,0 +1,25 @@
+#include "file.h"
+#include "isr80h/isr80h.h"
+#include "task/task.h"
+#include "task/process.h"
+#include "fs/io_ring.h"
+#include "kernel.h"
+
+// Map the I/O ring of the process, NULL if it can't be set up
+void *isr80h_command12_io_ring_setup(struct interrupt_frame *frame)
+{
+    struct io_ring *ring = io_ring_setup(task_current()->process);
+
+    if (ISERR(ring))
+        return NULL;
+
+    return ring;
+}
+
+// Run the requests queued in the I/O ring, returns how many were taken
+void *isr80h_command13_io_ring_enter(struct interrupt_frame *frame)
+{
+    uint32_t to_submit = (uint32_t) isr80h_get_argument(frame, 0);
+
+    return (void *) io_ring_enter(task_current()->process, to_submit);
+}
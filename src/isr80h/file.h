@@ -0,0 +1,8 @@
+#ifndef ISR80H_FILE_H
+#define ISR80H_FILE_H
+
+struct interrupt_frame;
+void *isr80h_command12_io_ring_setup(struct interrupt_frame *frame);
+void *isr80h_command13_io_ring_enter(struct interrupt_frame *frame);
+
+#endif // ISR80H_FILE_H
@@ -1,18 +1,40 @@
 #include <stddef.h>
 
 #include "heap.h"
+#include "isr80h/isr80h.h"
 #include "task/task.h"
 #include "task/process.h"
+#include "memory/memory.h"
+#include "memory/slab/slab.h"
 
 void *isr80h_command4_malloc(struct interrupt_frame *frame)
 {
-    size_t size = (int) task_get_stack_item(task_current(), 0);
+    size_t size = (int) isr80h_get_argument(frame, 0);
     return process_malloc(task_current()->process, size);
 }
 
 void *isr80h_command5_free(struct interrupt_frame *frame)
 {
-    void *ptr_to_free = task_get_stack_item(task_current(), 0);
+    void *ptr_to_free = isr80h_get_argument(frame, 0);
     process_free(task_current()->process, ptr_to_free);
     return NULL;
+}
+
+// Fill the user array with the statistics of up to "max" slab caches
+void *isr80h_command10_kmem_cache_stats(struct interrupt_frame *frame)
+{
+    struct kmem_cache_stat *stats_user_ptr = isr80h_get_argument(frame, 0);
+    int max = (int) isr80h_get_argument(frame, 1);
+    struct kmem_cache_stat stat;
+    int i;
+
+    for (i = 0; i < max; i++) {
+        if (kmem_cache_get_stats(i, &stat) < 0)
+            break;
+
+        if (copy_to_user(task_current(), &stats_user_ptr[i], &stat, sizeof(stat)) < 0)
+            break;
+    }
+
+    return (void *) i;
 }
\ No newline at end of file
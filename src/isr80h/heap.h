@@ -4,5 +4,6 @@
 struct interrupt_frame;
 void *isr80h_command4_malloc(struct interrupt_frame *frame);
 void *isr80h_command5_free(struct interrupt_frame *frame);
+void *isr80h_command10_kmem_cache_stats(struct interrupt_frame *frame);
 
 #endif // ISR80H_HEAP_H
\ No newline at end of file
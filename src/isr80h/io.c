@@ -1,4 +1,5 @@
 #include "io.h"
+#include "isr80h/isr80h.h"
 #include "task/task.h"
 #include "kernel.h"
 #include "keyboard/keyboard.h"
@@ -8,8 +9,9 @@ void *isr80h_command1_print(struct interrupt_frame *frame)
     void *user_space_msg_buffer;
     char buf[1024];
 
-    user_space_msg_buffer = task_get_stack_item(task_current(), 0);
-    copy_string_from_task(task_current(), user_space_msg_buffer, buf, sizeof(buf));
+    user_space_msg_buffer = isr80h_get_argument(frame, 0);
+    if (strncpy_from_user(task_current(), buf, user_space_msg_buffer, sizeof(buf)) < 0)
+        return NULL;
 
     print(buf);
 
@@ -24,7 +26,7 @@ void *isr80h_command2_getkey(struct interrupt_frame *frame)
 
 void *isr80h_command3_putchar(struct interrupt_frame *frame)
 {
-    char c = (char)(int) task_get_stack_item(task_current(), 0);
+    char c = (char)(int) isr80h_get_argument(frame, 0);
     terminal_writechar(c, 15);
     return NULL;
 }
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include "io.h"
 #include "heap.h"
 #include "isr80h/process.h"
+#include "isr80h/disk.h"
+#include "isr80h/file.h"
+#include "task/task.h"
 
 void isr80h_register_commands(void)
 {
@@ -17,4 +20,32 @@ void isr80h_register_commands(void)
     isr80h_register_command(SYSTEM_COMMAND7_INVOKE_SYSTEM_COMMAND, isr80h_command7_invoke_system_command);
     isr80h_register_command(SYSTEM_COMMAND8_GET_PROGRAM_ARGUMENTS, isr80h_command8_get_program_arguments);
     isr80h_register_command(SYSTEM_COMMAND9_EXIT, isr80h_command9_exit);
-}
\ No newline at end of file
+    isr80h_register_command(SYSTEM_COMMAND10_KMEM_CACHE_STATS, isr80h_command10_kmem_cache_stats);
+    isr80h_register_command(SYSTEM_COMMAND11_BCACHE_STATS, isr80h_command11_bcache_stats);
+    isr80h_register_command(SYSTEM_COMMAND12_IO_RING_SETUP, isr80h_command12_io_ring_setup);
+    isr80h_register_command(SYSTEM_COMMAND13_IO_RING_ENTER, isr80h_command13_io_ring_enter);
+    isr80h_register_command(SYSTEM_COMMAND14_SYNC, isr80h_command14_sync);
+    isr80h_register_command(SYSTEM_COMMAND15_BIO_STATS, isr80h_command15_bio_stats);
+}
+
+/* Argument "index" of the command, from the registers or from the user stack */
+void *isr80h_get_argument(struct interrupt_frame *frame, int index)
+{
+    if (!(frame->eax & ISR80H_REGISTER_ARGUMENTS))
+        return task_get_stack_item(task_current(), index);
+
+    switch (index) {
+    case 0:
+        return (void *) frame->ebx;
+    case 1:
+        return (void *) frame->ecx;
+    case 2:
+        return (void *) frame->edx;
+    case 3:
+        return (void *) frame->esi;
+    case 4:
+        return (void *) frame->edi;
+    }
+
+    return 0;
+}
@@ -1,6 +1,17 @@
 #ifndef ISR80H_H
 #define ISR80H_H
 
+#include <stdint.h>
+
+/*
+ * Set in eax along with the command when the arguments are passed in
+ * ebx, ecx, edx, esi and edi rather than pushed to the user stack.
+ */
+#define ISR80H_REGISTER_ARGUMENTS 0x80000000
+#define ISR80H_MAX_REGISTER_ARGUMENTS 5
+
+struct interrupt_frame;
+
 enum SystemCommands
 {
     SYSTEM_COMMAND0_SUM,
@@ -13,8 +24,15 @@ enum SystemCommands
     SYSTEM_COMMAND7_INVOKE_SYSTEM_COMMAND,
     SYSTEM_COMMAND8_GET_PROGRAM_ARGUMENTS,
     SYSTEM_COMMAND9_EXIT,
+    SYSTEM_COMMAND10_KMEM_CACHE_STATS,
+    SYSTEM_COMMAND11_BCACHE_STATS,
+    SYSTEM_COMMAND12_IO_RING_SETUP,
+    SYSTEM_COMMAND13_IO_RING_ENTER,
+    SYSTEM_COMMAND14_SYNC,
+    SYSTEM_COMMAND15_BIO_STATS,
 };
 
 void isr80h_register_commands(void);
+void *isr80h_get_argument(struct interrupt_frame *frame, int index);
 
 #endif // ISR80H_H
\ No newline at end of file
@@ -1,10 +1,11 @@
 #include "misc.h"
+#include "isr80h/isr80h.h"
 #include "idt/idt.h"
 #include "task/task.h"
 
 void *isr80h_command0_sum(struct interrupt_frame *frame)
 {
-    int v2 = (int) task_get_stack_item(task_current(), 1);
-    int v1 = (int) task_get_stack_item(task_current(), 0);
+    int v2 = (int) isr80h_get_argument(frame, 1);
+    int v1 = (int) isr80h_get_argument(frame, 0);
     return (void *)(v1 + v2);
 }
\ No newline at end of file
@@ -1,17 +1,19 @@
 #include "process.h"
+#include "isr80h/isr80h.h"
 #include "task/task.h"
 #include "config.h"
 #include "status.h"
 #include "task/process.h"
 #include "string/string.h"
 #include "kernel.h"
+#include "memory/heap/kheap.h"
 
 void *isr80h_command6_process_load_start(struct interrupt_frame *frame)
 {
-    void *filename_user_ptr = task_get_stack_item(task_current(), 0);
+    void *filename_user_ptr = isr80h_get_argument(frame, 0);
     char filename[PEACHOS_MAX_PATH];
 
-    int res = copy_string_from_task(task_current(), filename_user_ptr, filename, sizeof(filename));
+    int res = strncpy_from_user(task_current(), filename, filename_user_ptr, sizeof(filename));
     if (res < 0)
         goto out;
 
@@ -33,26 +35,72 @@ out:
     return NULL;
 }
 
+static void isr80h_free_command_arguments(struct command_argument *argument)
+{
+    while (argument) {
+        struct command_argument *next = argument->next;
+        kfree(argument);
+        argument = next;
+    }
+}
+
+/* Copy the user list of arguments to the kernel, NULL if it's invalid */
+static struct command_argument *isr80h_copy_command_arguments(struct command_argument *user_argument)
+{
+    struct command_argument *root = NULL;
+    struct command_argument **last = &root;
+
+    for (int i = 0; user_argument; i++) {
+        if (i == PEACHOS_MAX_COMMAND_ARGUMENTS)
+            goto err_free;
+
+        struct command_argument *argument = kzalloc(sizeof(struct command_argument));
+        if (!argument)
+            goto err_free;
+
+        *last = argument;
+        last = &argument->next;
+
+        if (copy_from_user(task_current(), argument, user_argument, sizeof(struct command_argument)) < 0)
+            goto err_free;
+
+        argument->argument[sizeof(argument->argument) - 1] = 0x00;
+        user_argument = argument->next;
+        argument->next = NULL;
+    }
+
+    return root;
+
+err_free:
+    isr80h_free_command_arguments(root);
+    return NULL;
+}
+
 void *isr80h_command7_invoke_system_command(struct interrupt_frame *frame)
 {
-    struct command_argument *arguments = task_virtual_address_to_physical(task_current(), task_get_stack_item(task_current(), 0));
+    struct command_argument *root_command_argument = isr80h_copy_command_arguments(isr80h_get_argument(frame, 0));
 
-    if (!arguments || strlen(arguments[0].argument) == 0)
+    if (!root_command_argument || strlen(root_command_argument->argument) == 0) {
+        isr80h_free_command_arguments(root_command_argument);
         return ERROR(-EINVARG);
+    }
 
-    struct command_argument *root_command_argument = &arguments[0];
     const char *program_name = root_command_argument->argument;
 
     char path[PEACHOS_MAX_PATH];
     strcpy(path, "0:/");
-    strncpy(path+3, program_name, sizeof(path));
+    strncpy(path+3, program_name, sizeof(path) - 3);
+    path[sizeof(path) - 1] = 0x00;
 
     struct process *process = 0;
     int res = process_load_switch(path, &process);
-    if (res < 0)
+    if (res < 0) {
+        isr80h_free_command_arguments(root_command_argument);
         return ERROR(res);
+    }
 
     res = process_inject_arguments(process, root_command_argument);
+    isr80h_free_command_arguments(root_command_argument);
     if (res < 0)
         return ERROR(res);
 
@@ -65,9 +113,13 @@ void *isr80h_command7_invoke_system_command(struct interrupt_frame *frame)
 void *isr80h_command8_get_program_arguments(struct interrupt_frame *frame)
 {
     struct process *process = task_current()->process;
-    struct process_arguments *arguments = task_virtual_address_to_physical(task_current(), task_get_stack_item(task_current(), 0));
+    struct process_arguments *arguments_user_ptr = isr80h_get_argument(frame, 0);
+    struct process_arguments arguments;
 
-    process_get_arguments(process, &arguments->argc, &arguments->argv);
+    process_get_arguments(process, &arguments.argc, &arguments.argv);
+
+    if (copy_to_user(task_current(), arguments_user_ptr, &arguments, sizeof(arguments)) < 0)
+        return ERROR(-EFAULT);
 
     return NULL;
 }
@@ -75,6 +127,7 @@ void *isr80h_command8_get_program_arguments(struct interrupt_frame *frame)
 void *isr80h_command9_exit(struct interrupt_frame *frame)
 {
     struct process *process = task_current()->process;
+
     process_terminate(process);
     task_next();
     return NULL;
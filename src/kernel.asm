@@ -32,16 +32,29 @@ _start:
 	or al, 2
 	out 0x92, al
 
-	; Remap the master PIC (Programable Interrupt Controller)
-	mov al, 00010001b
+	; Remap the PICs (Programable Interrupt Controller)
+	mov al, 00010001b	; Initialize, ICW4 needed
 	out 0x20, al		; Tell the master PIC
+	out 0xA0, al		; Tell the slave PIC
 
 	mov al, 0x20		; Interrupt 0x20 is where master ISR should start
 	out 0x21, al
+	mov al, 0x28		; Interrupt 0x28 is where slave ISR should start
+	out 0xA1, al
 
-	mov al, 00000001b
+	mov al, 00000100b	; The slave is on the master IRQ 2
 	out 0x21, al
-	; End remap of master PIC
+	mov al, 00000010b	; Cascade identity of the slave
+	out 0xA1, al
+
+	mov al, 00000001b	; 8086 mode
+	out 0x21, al
+	out 0xA1, al
+
+	xor al, al		; Unmask all the IRQs
+	out 0x21, al
+	out 0xA1, al
+	; End remap of the PICs
 
 	call kernel_main
 	jmp $
@@ -11,10 +11,14 @@
 #include "idt/idt.h"
 #include "io/io.h"
 #include "memory/heap/kheap.h"
+#include "memory/frame/frame.h"
 #include "memory/paging/paging.h"
 #include "disk/disk.h"
 #include "disk/streamer.h"
+#include "disk/bio.h"
+#include "disk/bcache.h"
 #include "fs/file.h"
+#include "fs/fat/fat16.h"
 #include "gdt/gdt.h"
 #include "config.h"
 #include "memory/memory.h"
@@ -105,6 +109,20 @@ void print(const char *str)
 		terminal_writechar(str[i], 15);
 }
 
+void print_number(uint32_t number)
+{
+	char buf[11];
+	int i = sizeof(buf) - 1;
+
+	buf[i] = 0;
+	do {
+		buf[--i] = '0' + (number % 10);
+		number /= 10;
+	} while (number);
+
+	print(&buf[i]);
+}
+
 void panic(const char *msg)
 {
 	print(msg);
@@ -117,7 +135,62 @@ void kernel_page(void)
 	paging_switch(kernel_chunk);
 }
 
+struct paging_4gb_chunk *kernel_paging_chunk(void)
+{
+	return kernel_chunk;
+}
+
 struct tss tss;
+
+/* Stack used when entering ring 0 from user land, by an interrupt or by sysenter */
+void kernel_set_stack(void *stack_top)
+{
+	tss.esp0 = (uint32_t) stack_top;
+	isr80h_sysenter_set_stack(stack_top);
+}
+
+/* Checks and measurements of the subsystems, one line of output each */
+static void kernel_selftest(void)
+{
+	kheap_selftest();
+	paging_selftest(kernel_chunk);
+	disk_selftest();
+	bio_selftest(disk_get(0));
+	if (PEACHOS_SELFTEST_WRITE) {
+		struct disk *disk = disk_get(0);
+
+		if (fat16_is_free_sector(disk, PEACHOS_SELFTEST_SCRATCH_LBA) &&
+		    fat16_is_free_sector(disk, PEACHOS_SELFTEST_SCRATCH_LBA + 1))
+			bcache_selftest(disk, PEACHOS_SELFTEST_SCRATCH_LBA);
+		else
+			print("bcache: scratch sectors in use, write-back not tested\n");
+	}
+	fat16_selftest(disk_get(0));
+}
+
+/* Load 0:/bench.elf to run "bench.elf <mode> [file]" once the tasks start */
+static void kernel_load_bench(const char *mode, const char *filename)
+{
+	struct command_argument arguments[3];
+	struct process *process = NULL;
+	int res;
+
+	memset(arguments, 0, sizeof(arguments));
+	strcpy(arguments[0].argument, "bench.elf");
+	arguments[0].next = &arguments[1];
+	strcpy(arguments[1].argument, mode);
+	if (filename) {
+		arguments[1].next = &arguments[2];
+		strcpy(arguments[2].argument, filename);
+	}
+
+	res = process_load_switch("0:/bench.elf", &process);
+	if (res != PEACHOS_ALL_OK)
+		panic("Failed to load bench.elf\n");
+
+	process_inject_arguments(process, arguments);
+}
+
 struct gdt gdt_real[PEACHOS_TOTAL_GDT_SEGMENTS];
 struct gdt_structured gdt_structured[PEACHOS_TOTAL_GDT_SEGMENTS] = {
 	{.base = 0x00, .limit = 0x00, .type = 0x00}, 					// NULL Segment
@@ -141,6 +214,9 @@ void kernel_main(void)
 	// Initialize the heap
 	kheap_init();
 
+	// Initialize the page frame allocator, for page tables and user pages
+	frame_init();
+
 	// Initialize the filesystems
 	fs_init();
 
@@ -152,15 +228,24 @@ void kernel_main(void)
 
 	// Setup the TSS
 	memset(&tss, 0x00, sizeof(tss));
-	tss.esp = 0x600000;
+	tss.esp0 = 0x600000;
 	tss.ss0 = KERNEL_DATA_SELECTOR;
 
 	// Load the TSS
 	tss_load(0x28);
 
 	// Setup paging
+	paging_init();
 	kernel_chunk = paging_new_4gb(PAGING_IS_WRITEABLE | PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL);
 
+	if (!kernel_chunk)
+		panic("Failed to create the kernel paging chunk\n");
+
+	// The kernel heap is supervisor only, keep it in the TLB across task switches
+	if (PEACHOS_PAGING_GLOBAL &&
+	    paging_set_global(kernel_chunk, (void *) PEACHOS_HEAP_ADDRESS, PEACHOS_HEAP_SIZE_BYTES) < 0)
+		panic("Failed to make the kernel heap mapping global\n");
+
 	// Switch to kernel paging chunk
 	paging_switch(kernel_chunk);
 
@@ -173,28 +258,36 @@ void kernel_main(void)
 	// Initialize all the system keyboards
 	keyboard_init();
 
-	struct process *process = NULL;
-	int res = process_load_switch("0:/blank.elf", &process);
-	if (res != PEACHOS_ALL_OK)
-		panic("Failed to load blank.elf\n");
-
-	struct command_argument argument;
-	strcpy(argument.argument, "Testing!");
-	argument.next = 0x00;
-
-	process_inject_arguments(process, &argument);
+	if (PEACHOS_SELFTEST) {
+		kernel_selftest();
 
+		// A CPU-bound task keeps running while the readers sleep on the
+		// disk, their requests of two different files share the queue
+		kernel_load_bench("syscall", NULL);
+		kernel_load_bench("spin", NULL);
+		kernel_load_bench("read", "0:/data1.bin");
+		kernel_load_bench("read", "0:/data2.bin");
+	} else {
+		struct process *process = NULL;
+		int res = process_load_switch("0:/blank.elf", &process);
+		if (res != PEACHOS_ALL_OK)
+			panic("Failed to load blank.elf\n");
 
+		struct command_argument argument;
+		strcpy(argument.argument, "Testing!");
+		argument.next = 0x00;
 
-	res = process_load_switch("0:/blank.elf", &process);
-	if (res != PEACHOS_ALL_OK)
-		panic("Failed to load blank.elf\n");
+		process_inject_arguments(process, &argument);
 
-	strcpy(argument.argument, "ABC!");
-	argument.next = 0x00;
+		res = process_load_switch("0:/blank.elf", &process);
+		if (res != PEACHOS_ALL_OK)
+			panic("Failed to load blank.elf\n");
 
-	process_inject_arguments(process, &argument);
+		strcpy(argument.argument, "ABC!");
+		argument.next = 0x00;
 
+		process_inject_arguments(process, &argument);
+	}
 
 	task_run_first_ever_task();
 
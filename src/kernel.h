@@ -7,6 +7,8 @@
 #ifndef KERNEL_H
 #define KERNEL_H
 
+#include <stdint.h>
+
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 20
 
@@ -16,8 +18,13 @@
 
 void kernel_main(void);
 void print(const char *str);
+void print_number(uint32_t number);
 void panic(const char *msg);
+struct paging_4gb_chunk;
+
 void kernel_page(void);
+struct paging_4gb_chunk *kernel_paging_chunk(void);
+void kernel_set_stack(void *stack_top);
 void kernel_registers(void);
 void terminal_writechar(char c, char colour);
 
@@ -54,7 +54,6 @@ void classic_keyboard_handle_interrupt(void)
     uint8_t scancode;
     uint8_t c;
 
-    kernel_page();
     scancode = insb(KEYBOARD_INPUT_PORT);
     insb(KEYBOARD_INPUT_PORT);  // Ignore the rogue byte sent to us
 
@@ -73,8 +72,6 @@ void classic_keyboard_handle_interrupt(void)
     c = classic_keyboard_scancode_to_char(scancode);
     if(c != 0)
         keyboard_push(c);
-
-    task_page();
 }
 
 struct keyboard *classic_init(void)
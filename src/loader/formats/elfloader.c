@@ -5,6 +5,7 @@
 #include "status.h"
 #include "memory/memory.h"
 #include "memory/heap/kheap.h"
+#include "memory/frame/frame.h"
 #include "memory/paging/paging.h"
 #include "string/string.h"
 #include "kernel.h"
@@ -192,7 +193,14 @@ int elf_load(const char *filename, struct elf_file **file_out)
     if (res < 0)
         goto out;
 
-    elf_file->elf_memory = kzalloc(stat.filesize);
+    // The segments get mapped to the process, the image comes in whole page frames
+    elf_file->elf_memory = frame_zalloc(frame_count(stat.filesize));
+    if (!elf_file->elf_memory) {
+        res = -ENOMEM;
+        goto out;
+    }
+    elf_file->in_memory_size = stat.filesize;
+
     res = fread(elf_file->elf_memory, stat.filesize, 1, fd);
     if (res < 0)
         goto out;
@@ -213,6 +221,6 @@ void elf_close(struct elf_file *file)
     if (!file)
         return;
 
-    kfree(file->elf_memory);
+    frame_free(file->elf_memory, frame_count(file->in_memory_size));
     kfree(file);
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+/*
+ * Physical page frame allocator
+ *
+ * Page tables and user pages (process images, stacks and process_malloc
+ * memory) come from a pool of 4 KiB frames that is separate from the kernel
+ * heap. Each frame is one bit of the bitmap, set when the frame is taken.
+ * Runs of frames are physically contiguous, so they can be used for DMA.
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#include <stdbool.h>
+
+#include "frame.h"
+#include "config.h"
+#include "memory/memory.h"
+
+#define FRAME_BITMAP_WORDS ((FRAME_TOTAL + 31) / 32)
+
+static uint32_t frame_bitmap[FRAME_BITMAP_WORDS];
+static uint32_t frames_free;
+
+// Frames below this index are all taken, single frame searches start here
+static uint32_t frame_hint;
+
+static bool frame_is_taken(uint32_t frame)
+{
+    return frame_bitmap[frame / 32] & (1 << (frame % 32));
+}
+
+static void frame_mark(uint32_t start, uint32_t total, bool taken)
+{
+    for (uint32_t i = start; i < start + total; i++) {
+        if (taken)
+            frame_bitmap[i / 32] |= (1 << (i % 32));
+        else
+            frame_bitmap[i / 32] &= ~(1 << (i % 32));
+    }
+}
+
+static void *frame_to_address(uint32_t frame)
+{
+    return (void *)(PEACHOS_FRAME_POOL_ADDRESS + (frame * FRAME_SIZE));
+}
+
+static int frame_from_address(void *address)
+{
+    return ((uint32_t) address - PEACHOS_FRAME_POOL_ADDRESS) / FRAME_SIZE;
+}
+
+static int frame_find_single(void)
+{
+    for (uint32_t word = frame_hint / 32; word < FRAME_BITMAP_WORDS; word++) {
+        // Skip 32 taken frames at once
+        if (frame_bitmap[word] == 0xFFFFFFFF)
+            continue;
+
+        uint32_t frame = (word * 32) + __builtin_ctz(~frame_bitmap[word]);
+        if (frame >= FRAME_TOTAL)
+            break;
+        return frame;
+    }
+
+    return -1;
+}
+
+static int frame_find_run(uint32_t total)
+{
+    uint32_t run = 0;
+
+    for (uint32_t i = frame_hint; i < FRAME_TOTAL; i++) {
+        if (frame_is_taken(i)) {
+            run = 0;
+            continue;
+        }
+
+        if (++run == total)
+            return i - total + 1;
+    }
+
+    return -1;
+}
+
+void frame_init(void)
+{
+    memset(frame_bitmap, 0, sizeof(frame_bitmap));
+    frames_free = FRAME_TOTAL;
+    frame_hint = 0;
+}
+
+/* Allocate "total" physically contiguous frames, NULL if there is none */
+void *frame_alloc(uint32_t total)
+{
+    int frame;
+
+    if (total == 0 || total > frames_free)
+        return NULL;
+
+    frame = total == 1 ? frame_find_single() : frame_find_run(total);
+    if (frame < 0)
+        return NULL;
+
+    frame_mark(frame, total, true);
+    frames_free -= total;
+
+    if (frame == frame_hint)
+        frame_hint += total;
+
+    return frame_to_address(frame);
+}
+
+/* Same as frame_alloc(), the frames are zeroed a word at a time */
+void *frame_zalloc(uint32_t total)
+{
+    uint32_t *ptr = frame_alloc(total);
+
+    if (!ptr)
+        return NULL;
+
+    for (uint32_t i = 0; i < (total * FRAME_SIZE) / sizeof(uint32_t); i++)
+        ptr[i] = 0;
+
+    return ptr;
+}
+
+void frame_free(void *frame, uint32_t total)
+{
+    int start = frame_from_address(frame);
+
+    if ((uint32_t) frame < PEACHOS_FRAME_POOL_ADDRESS || (uint32_t) frame % FRAME_SIZE)
+        return;
+
+    if (start + total > FRAME_TOTAL)
+        return;
+
+    for (uint32_t i = start; i < start + total; i++) {
+        if (frame_is_taken(i))
+            frames_free++;
+    }
+
+    frame_mark(start, total, false);
+
+    if (start < frame_hint)
+        frame_hint = start;
+}
+
+/* Number of frames needed to hold "size" bytes */
+uint32_t frame_count(size_t size)
+{
+    return (size + FRAME_SIZE - 1) / FRAME_SIZE;
+}
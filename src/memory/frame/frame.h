@@ -0,0 +1,24 @@
+/*
+ * Physical page frame allocator header
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+#define FRAME_SIZE 4096
+#define FRAME_TOTAL (PEACHOS_FRAME_POOL_SIZE_BYTES / FRAME_SIZE)
+
+void frame_init(void);
+void *frame_alloc(uint32_t total);
+void *frame_zalloc(uint32_t total);
+void frame_free(void *frame, uint32_t total);
+uint32_t frame_count(size_t size);
+
+#endif // FRAME_H
\ No newline at end of file
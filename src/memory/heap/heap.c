@@ -19,6 +19,10 @@ static bool heap_validate_table(void *ptr, void *end, struct heap_table *table)
     if (table->total != total_blocks)
         return false;
 
+    // Block indexes have to fit in the allocation starts
+    if (total_blocks > 0x10000)
+        return false;
+
     return true;
 }
 
@@ -46,52 +50,163 @@ static int heap_get_entry_type(HEAP_BLOCK_TABLE_ENTRY entry)
     return entry & 0x0F;
 }
 
-static int heap_get_start_block(struct heap *heap, uint32_t total_blocks)
+static void *heap_block_to_address(struct heap *heap, int block)
 {
-    struct heap_table *table = heap->table;
-    int bc = 0;  // block count
-    int bs = -1; // block start
-
-    for (size_t i = 0; i < table->total; i++) {
-        if (heap_get_entry_type(table->entries[i]) != HEAP_BLOCK_TABLE_ENTRY_FREE) {
-            bc = 0;
-            bs = -1;
-            continue;
-        }
-        /* Save first block index */
-        if (bs == -1)
-            bs = i;
-        bc++;
-        if (bc == total_blocks)
-            break;
+    return heap->saddr + (block * PEACHOS_HEAP_BLOCK_SIZE);
+}
+
+static int heap_address_to_block(struct heap *heap, void *address)
+{
+    return ((int)(address - heap->saddr)) / PEACHOS_HEAP_BLOCK_SIZE;
+}
+
+/* Free list index for a run of total_blocks, i.e. floor(log2(total_blocks)) */
+static int heap_free_list_index(uint32_t total_blocks)
+{
+    int index = 0;
+
+    while (total_blocks >>= 1)
+        index++;
+
+    return index;
+}
+
+static struct heap_free_run *heap_free_run_at(struct heap *heap, int block)
+{
+    return (struct heap_free_run *) heap_block_to_address(heap, block);
+}
+
+/* The footer lives in the last word of the last block of the run */
+static uint32_t *heap_free_run_footer(struct heap *heap, int last_block)
+{
+    return (uint32_t *) heap_block_to_address(heap, last_block + 1) - 1;
+}
+
+static void heap_free_list_insert(struct heap *heap, int start_block, uint32_t total_blocks)
+{
+    struct heap_free_run *run = heap_free_run_at(heap, start_block);
+    int index = heap_free_list_index(total_blocks);
+
+    run->total = total_blocks;
+    run->prev = NULL;
+    run->next = heap->free_lists[index];
+    if (run->next)
+        run->next->prev = run;
+
+    heap->free_lists[index] = run;
+    heap->free_lists_bitmap |= (1 << index);
+
+    *heap_free_run_footer(heap, start_block + total_blocks - 1) = start_block;
+}
+
+static void heap_free_list_remove(struct heap *heap, struct heap_free_run *run)
+{
+    int index = heap_free_list_index(run->total);
+
+    if (run->prev)
+        run->prev->next = run->next;
+    else
+        heap->free_lists[index] = run->next;
+
+    if (run->next)
+        run->next->prev = run->prev;
+
+    if (!heap->free_lists[index])
+        heap->free_lists_bitmap &= ~(1 << index);
+}
+
+/*
+ * Any run in a list above the class of total_blocks is big enough, so the
+ * head of the first non-empty list is taken. Only if there is none we fall
+ * back to a first-fit scan of the runs in the class of total_blocks.
+ */
+static struct heap_free_run *heap_find_free_run(struct heap *heap, uint32_t total_blocks)
+{
+    int index = heap_free_list_index(total_blocks);
+    int search_index = index;
+    uint32_t candidates;
+
+    // Runs in the same class may be smaller unless total_blocks is a power of two
+    if (total_blocks & (total_blocks - 1))
+        search_index++;
+
+    if (search_index < HEAP_FREE_LISTS_TOTAL) {
+        candidates = heap->free_lists_bitmap & ~((1 << search_index) - 1);
+        if (candidates)
+            return heap->free_lists[__builtin_ctz(candidates)];
     }
 
-    if (bs == -1)
-        return -ENOMEM;
+    for (struct heap_free_run *run = heap->free_lists[index]; run; run = run->next) {
+        if (run->total >= total_blocks)
+            return run;
+    }
 
-    return bs;
+    return NULL;
 }
 
-static void *heap_block_to_address(struct heap *heap, int block)
+static int heap_get_start_block(struct heap *heap, uint32_t total_blocks)
 {
-    return heap->saddr + (block * PEACHOS_HEAP_BLOCK_SIZE);
+    struct heap_free_run *run = heap_find_free_run(heap, total_blocks);
+    int start_block;
+
+    if (!run)
+        return -ENOMEM;
+
+    start_block = heap_address_to_block(heap, run);
+    heap_free_list_remove(heap, run);
+
+    // Give the blocks we don't need back to the free lists
+    if (run->total > total_blocks)
+        heap_free_list_insert(heap, start_block + total_blocks, run->total - total_blocks);
+
+    return start_block;
 }
 
-static int heap_address_to_block(struct heap *heap, void *address)
+static bool heap_block_is_free(struct heap *heap, int block)
 {
-    return ((int)(address - heap->saddr)) / PEACHOS_HEAP_BLOCK_SIZE;
+    if (block < 0 || block >= (int) heap->table->total)
+        return false;
+
+    return heap_get_entry_type(heap->table->entries[block]) == HEAP_BLOCK_TABLE_ENTRY_FREE;
 }
 
-static void heap_mark_blocks_free(struct heap *heap, int starting_block)
+static int heap_mark_blocks_free(struct heap *heap, int starting_block)
 {
     struct heap_table *table = heap->table;
+    int total_blocks = 0;
 
     for (int i = starting_block; i < (int)table->total; i++) {
         HEAP_BLOCK_TABLE_ENTRY entry = table->entries[i];
         table->entries[i] = HEAP_BLOCK_TABLE_ENTRY_FREE;
+        total_blocks++;
         if (!(entry & HEAP_BLOCK_HAS_NEXT))
             break;
     }
+
+    return total_blocks;
+}
+
+/* Merge the freed run with its free neighbours and put it back in the free lists */
+static void heap_coalesce_blocks(struct heap *heap, int start_block, uint32_t total_blocks)
+{
+    int right_block = start_block + total_blocks;
+    int left_block = start_block - 1;
+
+    if (heap_block_is_free(heap, right_block)) {
+        struct heap_free_run *right = heap_free_run_at(heap, right_block);
+        total_blocks += right->total;
+        heap_free_list_remove(heap, right);
+    }
+
+    if (heap_block_is_free(heap, left_block)) {
+        int left_start = *heap_free_run_footer(heap, left_block);
+        struct heap_free_run *left = heap_free_run_at(heap, left_start);
+        total_blocks += left->total;
+        start_block = left_start;
+        heap_free_list_remove(heap, left);
+    }
+
+    heap_free_list_insert(heap, start_block, total_blocks);
 }
 
 static void heap_mark_blocks_taken(struct heap *heap, int start_block, int total_blocks)
@@ -104,6 +219,7 @@ static void heap_mark_blocks_taken(struct heap *heap, int start_block, int total
 
     for (int i = start_block; i <= end_block; i++) {
         heap->table->entries[i] = entry;
+        heap->table->starts[i] = start_block;
         entry = HEAP_BLOCK_TABLE_ENTRY_TAKEN;
         if (i != end_block - 1)
             entry |= HEAP_BLOCK_HAS_NEXT;
@@ -139,7 +255,10 @@ int heap_create(struct heap *heap, void *ptr, void *end, struct heap_table *tabl
 
     size_t table_size = sizeof(HEAP_BLOCK_TABLE_ENTRY) * table->total;
     memset(table->entries, HEAP_BLOCK_TABLE_ENTRY_FREE, table_size);
-    
+
+    // The whole heap starts as a single free run
+    heap_free_list_insert(heap, 0, table->total);
+
     return 0;
 }
 
@@ -148,10 +267,39 @@ void *heap_malloc(struct heap *heap, size_t size)
     size_t aligned_size = heap_align_up(size);
     uint32_t total_blocks = aligned_size / PEACHOS_HEAP_BLOCK_SIZE;
 
+    // Zero sized requests still get a unique block
+    if (total_blocks == 0)
+        total_blocks = 1;
+
     return heap_malloc_blocks(heap, total_blocks);
 }
 
 void heap_free(struct heap *heap, void *ptr)
 {
-    heap_mark_blocks_free(heap, heap_address_to_block(heap, ptr));
+    int start_block = heap_address_to_block(heap, ptr);
+    int total_blocks;
+
+    if (ptr < heap->saddr || start_block >= (int) heap->table->total)
+        return;
+
+    // Only the first block of an allocation can be freed
+    if (!(heap->table->entries[start_block] & HEAP_BLOCK_IS_FIRST))
+        return;
+
+    total_blocks = heap_mark_blocks_free(heap, start_block);
+    heap_coalesce_blocks(heap, start_block, total_blocks);
+}
+
+/* Address of the first block of the allocation that contains ptr */
+void *heap_get_allocation_start(struct heap *heap, void *ptr)
+{
+    int block = heap_address_to_block(heap, ptr);
+
+    if (ptr < heap->saddr || block >= (int) heap->table->total)
+        return NULL;
+
+    if (heap_get_entry_type(heap->table->entries[block]) != HEAP_BLOCK_TABLE_ENTRY_TAKEN)
+        return NULL;
+
+    return heap_block_to_address(heap, heap->table->starts[block]);
 }
\ No newline at end of file
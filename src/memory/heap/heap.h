@@ -18,22 +18,46 @@
 #define HEAP_BLOCK_HAS_NEXT     0b10000000
 #define HEAP_BLOCK_IS_FIRST     0b01000000
 
+/* One free list per power of two run length, i.e. list n holds runs of [2^n, 2^(n+1)) blocks */
+#define HEAP_FREE_LISTS_TOTAL 32
+
 typedef unsigned char HEAP_BLOCK_TABLE_ENTRY;
 
 struct heap_table {
     HEAP_BLOCK_TABLE_ENTRY *entries;
+
+    /* First block of the allocation of each taken block */
+    uint16_t *starts;
     size_t total;
 };
 
+/*
+ * Header stored in the first block of every free run. The last block of the
+ * run stores the index of the first block so that runs can be coalesced
+ * with their left neighbour.
+ */
+struct heap_free_run {
+    uint32_t total;     // number of blocks in the run
+    struct heap_free_run *next;
+    struct heap_free_run *prev;
+};
+
 struct heap {
     struct heap_table *table;
 
     /* Start address of the heap data pool */
     void *saddr;
+
+    /* Segregated free lists indexed by log2 of the run length */
+    struct heap_free_run *free_lists[HEAP_FREE_LISTS_TOTAL];
+
+    /* Bit n is set when free_lists[n] is not empty */
+    uint32_t free_lists_bitmap;
 };
 
 int heap_create(struct heap *heap, void *ptr, void *end, struct heap_table *table);
 void *heap_malloc(struct heap *heap, size_t size);
 void heap_free(struct heap *heap, void *ptr);
+void *heap_get_allocation_start(struct heap *heap, void *ptr);
 
 #endif // HEAP_H
\ No newline at end of file
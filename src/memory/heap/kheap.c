@@ -1,23 +1,58 @@
 /*
  * Kernel heap implementation
  *
+ * Requests up to PEACHOS_KMALLOC_MAX_SIZE are served from power of two size
+ * class slab caches, anything bigger takes whole blocks of the kernel heap.
+ *
  * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
  */
 
+#include <stdbool.h>
+
 #include "kheap.h"
 #include "heap.h"
 #include "config.h"
 #include "kernel.h"
+#include "io/io.h"
 #include "memory/memory.h"
+#include "memory/slab/slab.h"
+
+#define KMALLOC_TOTAL_CACHES 8
+
+/* Blocks of the private heap of kheap_selftest_coalesce() */
+#define KHEAP_SELFTEST_BLOCKS 16
+
+/* Allocations timed per round by kheap_selftest_benchmark() */
+#define KHEAP_BENCH_POINTERS 256
+#define KHEAP_BENCH_ROUNDS 8
 
 struct heap kernel_heap;
 struct heap_table kernel_heap_table;
 
+static struct kmem_cache *kmalloc_caches[KMALLOC_TOTAL_CACHES];
+static const char *kmalloc_cache_names[KMALLOC_TOTAL_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+static void kheap_init_caches(void)
+{
+    size_t size = PEACHOS_KMALLOC_MIN_SIZE;
+
+    for (int i = 0; i < KMALLOC_TOTAL_CACHES && size <= PEACHOS_KMALLOC_MAX_SIZE; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_cache_names[i], size, NULL);
+        if (!kmalloc_caches[i])
+            panic("Failed to create the kmalloc caches\n");
+        size <<= 1;
+    }
+}
+
 void kheap_init(void)
 {
     int total_table_entries = PEACHOS_HEAP_SIZE_BYTES / PEACHOS_HEAP_BLOCK_SIZE;
     
     kernel_heap_table.entries = (HEAP_BLOCK_TABLE_ENTRY *) PEACHOS_HEAP_TABLE_ADDRESS;
+    kernel_heap_table.starts = (uint16_t *) PEACHOS_HEAP_STARTS_ADDRESS;
     kernel_heap_table.total = total_table_entries;
 
     void *end = (void *)(PEACHOS_HEAP_ADDRESS + PEACHOS_HEAP_SIZE_BYTES);
@@ -25,10 +60,28 @@ void kheap_init(void)
     if (res < 0)
         print("Failed to create heap\n");
 
+    kheap_init_caches();
+}
+
+static struct kmem_cache *kmalloc_get_cache(size_t size)
+{
+    size_t class_size = PEACHOS_KMALLOC_MIN_SIZE;
+    int index = 0;
+
+    while (class_size < size) {
+        class_size <<= 1;
+        index++;
+    }
+
+    return kmalloc_caches[index];
 }
 
 void *kmalloc(size_t size)
 {
+    // The size class caches get their slabs from the block heap
+    if (size <= PEACHOS_KMALLOC_MAX_SIZE && kmalloc_caches[0])
+        return kmem_cache_alloc(kmalloc_get_cache(size));
+
     return heap_malloc(&kernel_heap, size);
 }
 
@@ -42,5 +95,132 @@ void *kzalloc(size_t size)
 
 void kfree(void *ptr)
 {
-    heap_free(&kernel_heap, ptr);
-}
\ No newline at end of file
+    void *start = kheap_allocation_start(ptr);
+
+    if (!start)
+        return;
+
+    // Slab objects never start at the beginning of a heap allocation
+    if (start == ptr)
+        heap_free(&kernel_heap, ptr);
+    else
+        kmem_free(ptr);
+}
+
+void *kheap_allocation_start(void *ptr)
+{
+    return heap_get_allocation_start(&kernel_heap, ptr);
+}
+
+/* A run of "total" blocks is the only free run of the heap */
+static bool kheap_selftest_single_run(struct heap *heap, uint32_t total)
+{
+    int runs = 0;
+
+    for (int i = 0; i < HEAP_FREE_LISTS_TOTAL; i++) {
+        for (struct heap_free_run *run = heap->free_lists[i]; run; run = run->next) {
+            if (run->total != total)
+                return false;
+            runs++;
+        }
+    }
+
+    return runs == 1;
+}
+
+/*
+ * Runs of 1, 2 and 3 blocks are taken from a private heap and freed in two
+ * different orders. Each time they must merge back into a single free run
+ * that covers the whole heap.
+ */
+static bool kheap_selftest_coalesce(void)
+{
+    static HEAP_BLOCK_TABLE_ENTRY entries[KHEAP_SELFTEST_BLOCKS];
+    static uint16_t starts[KHEAP_SELFTEST_BLOCKS];
+    struct heap_table table = { .entries = entries, .starts = starts, .total = KHEAP_SELFTEST_BLOCKS };
+    size_t size = KHEAP_SELFTEST_BLOCKS * PEACHOS_HEAP_BLOCK_SIZE;
+    struct heap heap;
+    bool ok = true;
+    void *pool;
+
+    pool = heap_malloc(&kernel_heap, size);
+    if (!pool)
+        return false;
+
+    if (heap_create(&heap, pool, pool + size, &table) < 0) {
+        heap_free(&kernel_heap, pool);
+        return false;
+    }
+
+    for (int round = 0; ok && round < 2; round++) {
+        void *a = heap_malloc(&heap, PEACHOS_HEAP_BLOCK_SIZE);
+        void *b = heap_malloc(&heap, 2 * PEACHOS_HEAP_BLOCK_SIZE);
+        void *c = heap_malloc(&heap, 3 * PEACHOS_HEAP_BLOCK_SIZE);
+
+        if (!a || !b || !c || heap_get_allocation_start(&heap, b + PEACHOS_HEAP_BLOCK_SIZE + 8) != b) {
+            ok = false;
+            break;
+        }
+
+        if (round == 0) {
+            // "b" merges with both of its neighbours
+            heap_free(&heap, a);
+            heap_free(&heap, c);
+            heap_free(&heap, b);
+        } else {
+            // Each run merges with the run at its right
+            heap_free(&heap, c);
+            heap_free(&heap, b);
+            heap_free(&heap, a);
+        }
+
+        ok = kheap_selftest_single_run(&heap, KHEAP_SELFTEST_BLOCKS);
+    }
+
+    if (ok)
+        ok = heap_malloc(&heap, size) == pool;
+
+    heap_free(&kernel_heap, pool);
+    return ok;
+}
+
+/* Average cycles of kmalloc() and kfree() over a mix of slab and block sizes */
+static void kheap_selftest_benchmark(uint32_t *alloc_cycles, uint32_t *free_cycles)
+{
+    static const size_t sizes[] = { 16, 100, 700, 2048, 5000, 20000 };
+    static void *ptrs[KHEAP_BENCH_POINTERS];
+    uint32_t start;
+
+    *alloc_cycles = 0;
+    *free_cycles = 0;
+
+    for (int round = 0; round < KHEAP_BENCH_ROUNDS; round++) {
+        start = read_tsc();
+        for (int i = 0; i < KHEAP_BENCH_POINTERS; i++)
+            ptrs[i] = kmalloc(sizes[i % (sizeof(sizes) / sizeof(sizes[0]))]);
+        *alloc_cycles += read_tsc() - start;
+
+        start = read_tsc();
+        for (int i = 0; i < KHEAP_BENCH_POINTERS; i++)
+            kfree(ptrs[i]);
+        *free_cycles += read_tsc() - start;
+    }
+
+    *alloc_cycles /= KHEAP_BENCH_ROUNDS * KHEAP_BENCH_POINTERS;
+    *free_cycles /= KHEAP_BENCH_ROUNDS * KHEAP_BENCH_POINTERS;
+}
+
+void kheap_selftest(void)
+{
+    uint32_t alloc_cycles;
+    uint32_t free_cycles;
+
+    print(kheap_selftest_coalesce() ? "kheap: coalescing ok" : "kheap: coalescing FAILED");
+
+    kheap_selftest_benchmark(&alloc_cycles, &free_cycles);
+    print(", kmalloc ");
+    print_number(alloc_cycles);
+    print(" cycles, kfree ");
+    print_number(free_cycles);
+    print(" cycles\n");
+}
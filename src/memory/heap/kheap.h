@@ -14,5 +14,7 @@ void kheap_init(void);
 void *kmalloc(size_t size);
 void *kzalloc(size_t size);
 void kfree(void *ptr);
+void *kheap_allocation_start(void *ptr);
+void kheap_selftest(void);
 
 #endif // KHEAP_H
\ No newline at end of file
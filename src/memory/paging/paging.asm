@@ -8,6 +8,9 @@ section .asm
 
 global paging_load_directory
 global enable_paging
+global paging_cpu_features
+global paging_set_cr4
+global paging_invalidate_page
 
 ; void paging_load_directory(uint32_t *directory)
 paging_load_directory:
@@ -26,4 +29,35 @@ enable_paging:
     or eax, 0x80000000
     mov cr0, eax
     pop ebp
-    ret
\ No newline at end of file
+    ret
+
+; uint32_t paging_cpu_features(void)
+paging_cpu_features:
+    push ebp
+    mov ebp, esp
+    push ebx
+    mov eax, 1
+    cpuid
+    mov eax, edx        ; CPUID.01h:EDX feature flags
+    pop ebx
+    pop ebp
+    ret
+
+; void paging_set_cr4(uint32_t bits)
+paging_set_cr4:
+    push ebp
+    mov ebp, esp
+    mov eax, cr4
+    or eax, [ebp+8]
+    mov cr4, eax
+    pop ebp
+    ret
+
+; void paging_invalidate_page(void *virt)
+paging_invalidate_page:
+    push ebp
+    mov ebp, esp
+    mov eax, [ebp+8]
+    invlpg [eax]
+    pop ebp
+    ret
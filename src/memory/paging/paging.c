@@ -8,18 +8,56 @@
 
 #include "paging.h"
 #include "memory/heap/kheap.h"
+#include "memory/frame/frame.h"
+#include "io/io.h"
+#include "config.h"
+#include "kernel.h"
 #include "status.h"
 
 static uint32_t *current_directory = 0;
 
+// The identity map is made of 4MB pages when the CPU supports it
+static bool paging_large_pages = false;
+
+#define PAGING_CPUID_PSE (1 << 3)
+#define PAGING_CPUID_PGE (1 << 13)
+#define PAGING_CR4_PSE (1 << 4)
+#define PAGING_CR4_PGE (1 << 7)
+
+// Pages of the kernel heap read by paging_selftest()
+#define PAGING_SELFTEST_PAGES (PEACHOS_HEAP_SIZE_BYTES / PAGING_PAGE_SIZE)
+
 // From assembly
 void paging_load_directory(uint32_t *directory);
+uint32_t paging_cpu_features(void);
+void paging_set_cr4(uint32_t bits);
+void paging_invalidate_page(void *virt);
 
-struct paging_4gb_chunk *paging_new_4gb(uint8_t flags)
+/* Must be called before the first paging_new_4gb() */
+void paging_init(void)
 {
-    uint32_t *directory = kzalloc(sizeof(uint32_t) * PAGING_TOTAL_ENTRIES_PER_TABLE);
+    uint32_t features = paging_cpu_features();
+
+    if (features & PAGING_CPUID_PSE) {
+        paging_set_cr4(PAGING_CR4_PSE);
+        paging_large_pages = true;
+    }
+
+    // Without it the global bit is just ignored
+    if (features & PAGING_CPUID_PGE)
+        paging_set_cr4(PAGING_CR4_PGE);
+}
+
+/* The identity map of paging_new_4gb(), with 4MB pages if "large_pages" */
+static struct paging_4gb_chunk *paging_new_4gb_pages(uint8_t flags, bool large_pages)
+{
+    // Zeroed, the entries after a failed allocation are never freed
+    uint32_t *directory = frame_zalloc(1);
     int offset = 0;
 
+    if (!directory)
+        return NULL;
+
     /*
     Virtual address == Physical address, for the entire 4GB chunk
     E.g.: virtual 0x1000 --> physical 0x1000
@@ -43,36 +81,152 @@ struct paging_4gb_chunk *paging_new_4gb(uint8_t flags)
 
     /* Page directory */
     for (int pgd = 0; pgd < PAGING_TOTAL_ENTRIES_PER_TABLE; pgd++) {
-        uint32_t *page_table = kzalloc(sizeof(uint32_t) * PAGING_TOTAL_ENTRIES_PER_TABLE);
+        // A single 4MB page, split later if it needs a finer mapping
+        if (large_pages) {
+            directory[pgd] = offset | flags | PAGING_IS_WRITEABLE | PAGING_IS_LARGE;
+            offset += (PAGING_TOTAL_ENTRIES_PER_TABLE * PAGING_PAGE_SIZE);
+            continue;
+        }
+
+        uint32_t *page_table = frame_alloc(1);
+        if (!page_table)
+            goto out_free;
+
         /* Page table */
         for (int pte = 0; pte < PAGING_TOTAL_ENTRIES_PER_TABLE; pte++) {
             page_table[pte] = (offset + (pte * PAGING_PAGE_SIZE)) | flags;
         }
         offset += (PAGING_TOTAL_ENTRIES_PER_TABLE * PAGING_PAGE_SIZE);
-        directory[pgd] = (uint32_t) page_table | flags | PAGING_IS_WRITEABLE;
+        directory[pgd] = (uint32_t) page_table | flags | PAGING_IS_WRITEABLE | PAGING_IS_PRIVATE;
     }
 
     struct paging_4gb_chunk *chunk_4gb = kzalloc(sizeof(struct paging_4gb_chunk));
+    if (!chunk_4gb)
+        goto out_free;
+
+    chunk_4gb->directory_entry = directory;
+    chunk_4gb->flags = flags;
+
+    return chunk_4gb;
+
+out_free:
+    for (int pgd = 0; pgd < PAGING_TOTAL_ENTRIES_PER_TABLE && directory[pgd]; pgd++) {
+        if (directory[pgd] & PAGING_IS_PRIVATE)
+            frame_free((void *)(directory[pgd] & 0xfffff000), 1);
+    }
+    frame_free(directory, 1);
+    return NULL;
+}
+
+struct paging_4gb_chunk *paging_new_4gb(uint8_t flags)
+{
+    return paging_new_4gb_pages(flags, paging_large_pages);
+}
+
+/*
+ * Same 4GB identity map as paging_new_4gb(), but only the page directory is
+ * allocated: every entry points to the page table (or the 4MB page) of the
+ * kernel chunk. As the
+ * directory entries don't have the writeable bit, the shared tables can't be
+ * written from user mode. A table is copied the first time it gets a mapping
+ * of its own, see paging_map().
+ */
+struct paging_4gb_chunk *paging_new_4gb_shared(struct paging_4gb_chunk *kernel_chunk, uint8_t flags)
+{
+    uint32_t *directory = frame_alloc(1);
+    struct paging_4gb_chunk *chunk_4gb;
+
+    if (!directory)
+        return NULL;
+
+    for (int pgd = 0; pgd < PAGING_TOTAL_ENTRIES_PER_TABLE; pgd++) {
+        uint32_t entry = kernel_chunk->directory_entry[pgd];
+
+        // Global 4MB pages must be mapped exactly as in the kernel
+        if ((entry & PAGING_IS_LARGE) && (entry & PAGING_IS_GLOBAL)) {
+            directory[pgd] = entry;
+            continue;
+        }
+
+        directory[pgd] = (entry & 0xfffff000) | (entry & PAGING_IS_LARGE) | flags;
+    }
+
+    chunk_4gb = kzalloc(sizeof(struct paging_4gb_chunk));
+    if (!chunk_4gb) {
+        frame_free(directory, 1);
+        return NULL;
+    }
+
     chunk_4gb->directory_entry = directory;
+    chunk_4gb->flags = flags;
 
     return chunk_4gb;
 }
 
+/*
+ * Replace the shared page table of the directory entry by a private copy.
+ * A 4MB page is split into a table of 4KB pages mapping the same memory.
+ */
+static int paging_make_table_private(struct paging_4gb_chunk *chunk, uint32_t directory_index)
+{
+    uint32_t entry = chunk->directory_entry[directory_index];
+    uint32_t *shared_table = (uint32_t *) (entry & 0xfffff000);
+    uint32_t *table;
+
+    if (entry & PAGING_IS_PRIVATE)
+        return 0;
+
+    table = frame_alloc(1);
+    if (!table)
+        return -ENOMEM;
+
+    for (int pte = 0; pte < PAGING_TOTAL_ENTRIES_PER_TABLE; pte++) {
+        if (entry & PAGING_IS_LARGE)
+            table[pte] = (entry & 0xffc00000) + (pte * PAGING_PAGE_SIZE);
+        else
+            table[pte] = shared_table[pte] & 0xfffff000;
+
+        // Global pages keep the kernel flags
+        if (entry & PAGING_IS_GLOBAL)
+            table[pte] |= entry & (PAGING_IS_GLOBAL | PAGING_IS_WRITEABLE | PAGING_IS_PRESENT);
+        else if (!(entry & PAGING_IS_LARGE) && (shared_table[pte] & PAGING_IS_GLOBAL))
+            table[pte] |= shared_table[pte] & 0xfff;
+        else
+            table[pte] |= chunk->flags;
+    }
+
+    chunk->directory_entry[directory_index] = (uint32_t) table | chunk->flags |
+                                              PAGING_IS_WRITEABLE | PAGING_IS_PRIVATE;
+
+    if (chunk->directory_entry == current_directory)
+        paging_invalidate_page((void *)(directory_index * PAGING_TOTAL_ENTRIES_PER_TABLE * PAGING_PAGE_SIZE));
+
+    return 0;
+}
+
 void paging_switch(struct paging_4gb_chunk *directory)
 {
     paging_load_directory(directory->directory_entry);
     current_directory = directory->directory_entry;
 }
 
+bool paging_is_current(struct paging_4gb_chunk *directory)
+{
+    return directory->directory_entry == current_directory;
+}
+
 void paging_free_4gb(struct paging_4gb_chunk *chunk)
 {
     for (int i = 0; i < 1024; i++) {
         uint32_t entry = chunk->directory_entry[i];
         uint32_t *table = (uint32_t *) (entry & 0xfffff000);
-        kfree(table);
+
+        // Shared tables belong to the kernel chunk
+        if (entry & PAGING_IS_PRIVATE)
+            frame_free(table, 1);
     }
 
-    kfree(chunk->directory_entry);
+    frame_free(chunk->directory_entry, 1);
     kfree(chunk);
 }
 
@@ -114,11 +268,53 @@ void *paging_align_to_lower_page(void *addr)
 
 int paging_map(struct paging_4gb_chunk *directory, void *virt, void *phys, int flags)
 {
+    uint32_t directory_index = 0;
+    uint32_t table_index = 0;
+    int res;
+
     if ((unsigned int) virt % PAGING_PAGE_SIZE ||
         (unsigned int) phys % PAGING_PAGE_SIZE)
         return -EINVARG;
 
-    return paging_set(directory->directory_entry, virt, (uint32_t) phys | flags);
+    res = paging_get_indexes(virt, &directory_index, &table_index);
+    if (res < 0)
+        return res;
+
+    res = paging_make_table_private(directory, directory_index);
+    if (res < 0)
+        return res;
+
+    return paging_set(directory->directory_entry, virt, (uint32_t) phys | flags | PAGING_IS_PRIVATE);
+}
+
+/*
+ * Make the kernel mapping of [virt, virt + size) global and supervisor only,
+ * so that it stays in the TLB when switching to a task directory. With 4MB
+ * pages the whole directory entry is changed. Call it before creating the
+ * task directories, they copy the global entries.
+ */
+int paging_set_global(struct paging_4gb_chunk *chunk, void *virt, size_t size)
+{
+    uint32_t directory_index = 0;
+    uint32_t table_index = 0;
+    int res;
+
+    for (uint32_t offset = 0; offset < size; offset += PAGING_PAGE_SIZE) {
+        res = paging_get_indexes(virt + offset, &directory_index, &table_index);
+        if (res < 0)
+            return res;
+
+        uint32_t *entry = &chunk->directory_entry[directory_index];
+        if (*entry & PAGING_IS_LARGE) {
+            *entry = (*entry | PAGING_IS_GLOBAL) & ~PAGING_ACCESS_FROM_ALL;
+            continue;
+        }
+
+        uint32_t *table = (uint32_t *) (*entry & 0xfffff000);
+        table[table_index] = (table[table_index] | PAGING_IS_GLOBAL) & ~PAGING_ACCESS_FROM_ALL;
+    }
+
+    return 0;
 }
 
 int paging_map_range(struct paging_4gb_chunk *directory, void *virt, void *phys, int count, int flags)
@@ -177,8 +373,17 @@ int paging_set(uint32_t *directory, void *virt, uint32_t val)
 
     uint32_t entry = directory[directory_index];
     uint32_t *table = (uint32_t *) (entry & 0xfffff000);
+
+    // Writing to a shared table would change the kernel mapping
+    if (!(entry & PAGING_IS_PRIVATE))
+        return -ERDONLY;
+
     table[table_index] = val;
 
+    // No need to reload CR3, just drop the stale TLB entry
+    if (directory == current_directory)
+        paging_invalidate_page(virt);
+
     return 0;
 }
 
@@ -189,6 +394,85 @@ uint32_t paging_get(uint32_t *directory, void *virt)
     int res = paging_get_indexes(virt, &directory_index, &table_index);
     if (res < 0)
         return res;
-    uint32_t *table = (uint32_t*) (directory[directory_index] & 0xfffff000);
+    uint32_t entry = directory[directory_index];
+
+    // Same as the page table entry the 4MB page would be split into
+    if (entry & PAGING_IS_LARGE)
+        return ((entry & 0xffc00000) + (table_index * PAGING_PAGE_SIZE)) | (entry & 0xfff & ~PAGING_IS_LARGE);
+
+    uint32_t *table = (uint32_t*) (entry & 0xfffff000);
     return table[table_index];
-}
\ No newline at end of file
+}
+
+/*
+ * Access flags of the page as seen by the CPU, i.e. the directory and table
+ * entries combined. PAGING_IS_PRIVATE is set if the page was mapped by
+ * paging_map() in this directory.
+ */
+uint32_t paging_get_flags(uint32_t *directory, void *virt)
+{
+    uint32_t directory_index = 0;
+    uint32_t table_index = 0;
+    int res = paging_get_indexes(paging_align_to_lower_page(virt), &directory_index, &table_index);
+    if (res < 0)
+        return 0;
+
+    uint32_t flags = PAGING_IS_PRESENT | PAGING_IS_WRITEABLE | PAGING_ACCESS_FROM_ALL | PAGING_IS_PRIVATE;
+    return directory[directory_index] & paging_get(directory, paging_align_to_lower_page(virt)) & flags;
+}
+
+/*
+ * Cycles to read a word of each page of the kernel heap on "chunk", with
+ * none of the heap in the TLB. invlpg drops the global entries too.
+ */
+static uint32_t paging_selftest_walk(struct paging_4gb_chunk *chunk)
+{
+    volatile uint32_t *heap = (volatile uint32_t *) PEACHOS_HEAP_ADDRESS;
+    uint32_t start;
+
+    paging_switch(chunk);
+    for (uint32_t i = 0; i < PAGING_SELFTEST_PAGES; i++)
+        paging_invalidate_page((void *) &heap[i * (PAGING_PAGE_SIZE / sizeof(uint32_t))]);
+
+    start = read_tsc();
+    for (uint32_t i = 0; i < PAGING_SELFTEST_PAGES; i++)
+        (void) heap[i * (PAGING_PAGE_SIZE / sizeof(uint32_t))];
+
+    return read_tsc() - start;
+}
+
+/*
+ * Walk the kernel heap a page at a time on the 4MB pages of the kernel chunk
+ * and on a chunk of 4KB page tables, and report the cycles per page. Each
+ * page read is a TLB miss with 4KB pages, 8 entries cover the heap with 4MB
+ * pages.
+ */
+void paging_selftest(struct paging_4gb_chunk *kernel_chunk)
+{
+    struct paging_4gb_chunk *small_chunk;
+    uint32_t large_cycles;
+    uint32_t small_cycles;
+
+    if (!paging_large_pages) {
+        print("paging: no 4MB pages\n");
+        return;
+    }
+
+    small_chunk = paging_new_4gb_pages(kernel_chunk->flags, false);
+    if (!small_chunk) {
+        print("paging: self-test out of memory\n");
+        return;
+    }
+
+    large_cycles = paging_selftest_walk(kernel_chunk);
+    small_cycles = paging_selftest_walk(small_chunk);
+
+    paging_switch(kernel_chunk);
+    paging_free_4gb(small_chunk);
+
+    print("paging: heap walk ");
+    print_number(large_cycles / PAGING_SELFTEST_PAGES);
+    print(" cycles per page with 4MB pages, ");
+    print_number(small_cycles / PAGING_SELFTEST_PAGES);
+    print(" with 4KB pages\n");
+}
@@ -18,16 +18,32 @@
 #define PAGING_IS_WRITEABLE     0b00000010
 #define PAGING_IS_PRESENT       0b00000001
 
+// Page directory entry bit, the entry maps a 4MB page instead of a page table
+#define PAGING_IS_LARGE         0b10000000
+
+// The TLB entry survives CR3 reloads, the mapping must be the same in every directory
+#define PAGING_IS_GLOBAL        0b100000000
+
+// Entry bit available to software. In a directory entry: the page table belongs
+// to this directory, tables without it are shared with the kernel directory. In
+// a page table entry: the page was mapped by paging_map(), not identity mapped.
+#define PAGING_IS_PRIVATE       0b1000000000
+
 #define PAGING_TOTAL_ENTRIES_PER_TABLE 1024
 #define PAGING_PAGE_SIZE 4096
 
 struct paging_4gb_chunk {
     uint32_t *directory_entry;
+    // Page entry flags used for the identity mapping
+    uint8_t flags;
 };
 
 uint32_t *paging_4gb_chunk_get_directory(struct paging_4gb_chunk * chunk);
+void paging_init(void);
 struct paging_4gb_chunk *paging_new_4gb(uint8_t flags);
+struct paging_4gb_chunk *paging_new_4gb_shared(struct paging_4gb_chunk *kernel_chunk, uint8_t flags);
 void paging_switch(struct paging_4gb_chunk *directory);
+bool paging_is_current(struct paging_4gb_chunk *directory);
 void enable_paging(void);
 bool paging_is_aligned(void *addr);
 int paging_set(uint32_t *directory, void *virt, uint32_t val);
@@ -36,9 +52,12 @@ void paging_free_4gb(struct paging_4gb_chunk *chunk);
 int paging_map_to(struct paging_4gb_chunk *directory, void *virt, void *phys, void *phys_end, int flags);
 int paging_map_range(struct paging_4gb_chunk *directory, void *virt, void *phys, int count, int flags);
 int paging_map(struct paging_4gb_chunk *directory, void *virt, void *phys, int flags);
+int paging_set_global(struct paging_4gb_chunk *chunk, void *virt, size_t size);
 void *paging_align_address(void *ptr);
 uint32_t paging_get(uint32_t *directory, void *virt);
+uint32_t paging_get_flags(uint32_t *directory, void *virt);
 void *paging_align_to_lower_page(void *addr);
 void *paging_get_physical_address(uint32_t *directory, void *virt);
+void paging_selftest(struct paging_4gb_chunk *kernel_chunk);
 
 #endif // PAGING_H
\ No newline at end of file
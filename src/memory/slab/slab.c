@@ -0,0 +1,264 @@
+/*
+ * Slab allocator
+ *
+ * Small fixed-size kernel objects are carved out of heap blocks instead of
+ * each one taking a whole PEACHOS_HEAP_BLOCK_SIZE block from the kernel heap.
+ * The slab of an object is found from the heap block table, see
+ * kheap_allocation_start().
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#include "slab.h"
+#include "config.h"
+#include "status.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+#include "string/string.h"
+
+// The caches themselves are allocated from this one
+static struct kmem_cache kmem_cache_cache = {
+    .name = "kmem_cache",
+    .object_size = sizeof(struct kmem_cache),
+};
+
+// List of all the caches, used for the statistics
+static struct kmem_cache *kmem_caches = &kmem_cache_cache;
+
+static size_t kmem_align_object_size(size_t size)
+{
+    // Free objects must be able to hold the free list link
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+
+    return (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+static uint32_t kmem_slab_header_size(void)
+{
+    return kmem_align_object_size(sizeof(struct kmem_slab));
+}
+
+/* Big objects get slabs of several blocks so that at most ~1/8 of a slab is wasted */
+static size_t kmem_slab_size(size_t object_size)
+{
+    size_t total_blocks = (object_size * 8) / PEACHOS_HEAP_BLOCK_SIZE;
+
+    if (total_blocks == 0)
+        total_blocks = 1;
+
+    return total_blocks * PEACHOS_HEAP_BLOCK_SIZE;
+}
+
+static uint32_t kmem_objects_per_slab(size_t object_size)
+{
+    return (kmem_slab_size(object_size) - kmem_slab_header_size()) / object_size;
+}
+
+static struct kmem_slab *kmem_object_to_slab(void *object)
+{
+    struct kmem_slab *slab = kheap_allocation_start(object);
+
+    if (!slab || slab->magic != KMEM_SLAB_MAGIC)
+        return NULL;
+
+    return slab;
+}
+
+static void kmem_slab_list_insert(struct kmem_slab **list, struct kmem_slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (slab->next)
+        slab->next->prev = slab;
+    *list = slab;
+}
+
+static void kmem_slab_list_remove(struct kmem_slab **list, struct kmem_slab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+
+    if (slab->next)
+        slab->next->prev = slab->prev;
+
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static struct kmem_slab *kmem_slab_new(struct kmem_cache *cache)
+{
+    struct kmem_slab *slab;
+    char *object;
+
+    slab = kmalloc(cache->slab_size);
+    if (!slab)
+        return NULL;
+
+    memset(slab, 0, sizeof(struct kmem_slab));
+    slab->magic = KMEM_SLAB_MAGIC;
+    slab->cache = cache;
+
+    // Chain all the objects in the free list
+    object = (char *) slab + kmem_slab_header_size();
+    for (uint32_t i = 0; i < cache->objects_per_slab; i++) {
+        *(void **) object = slab->free;
+        slab->free = object;
+        object += cache->object_size;
+    }
+
+    cache->total_slabs++;
+    kmem_slab_list_insert(&cache->partial, slab);
+
+    return slab;
+}
+
+static void kmem_slab_free(struct kmem_cache *cache, struct kmem_slab *slab)
+{
+    kmem_slab_list_remove(&cache->partial, slab);
+    cache->total_slabs--;
+    slab->magic = 0;
+    kfree(slab);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, KMEM_CACHE_CONSTRUCTOR constructor)
+{
+    struct kmem_cache *cache;
+
+    size = kmem_align_object_size(size);
+    if (kmem_objects_per_slab(size) == 0)
+        return NULL;
+
+    if (!kmem_cache_cache.objects_per_slab) {
+        kmem_cache_cache.object_size = kmem_align_object_size(sizeof(struct kmem_cache));
+        kmem_cache_cache.slab_size = kmem_slab_size(kmem_cache_cache.object_size);
+        kmem_cache_cache.objects_per_slab = kmem_objects_per_slab(kmem_cache_cache.object_size);
+    }
+
+    cache = kmem_cache_zalloc(&kmem_cache_cache);
+    if (!cache)
+        return NULL;
+
+    strncpy(cache->name, name, sizeof(cache->name) - 1);
+    cache->object_size = size;
+    cache->slab_size = kmem_slab_size(size);
+    cache->objects_per_slab = kmem_objects_per_slab(size);
+    cache->constructor = constructor;
+
+    cache->next = kmem_caches;
+    kmem_caches = cache;
+
+    return cache;
+}
+
+static void *kmem_cache_get_object(struct kmem_cache *cache)
+{
+    struct kmem_slab *slab = cache->partial;
+    void *object;
+
+    if (!slab) {
+        slab = kmem_slab_new(cache);
+        if (!slab)
+            return NULL;
+    }
+
+    object = slab->free;
+    slab->free = *(void **) object;
+    slab->inuse++;
+    cache->total_inuse++;
+
+    if (!slab->free) {
+        kmem_slab_list_remove(&cache->partial, slab);
+        kmem_slab_list_insert(&cache->full, slab);
+    }
+
+    return object;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    void *object = kmem_cache_get_object(cache);
+
+    if (object && cache->constructor)
+        cache->constructor(object);
+
+    return object;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cache)
+{
+    void *object = kmem_cache_get_object(cache);
+
+    if (!object)
+        return NULL;
+
+    memset(object, 0x00, cache->object_size);
+    if (cache->constructor)
+        cache->constructor(object);
+
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *object)
+{
+    struct kmem_slab *slab;
+
+    if (!object)
+        return;
+
+    slab = kmem_object_to_slab(object);
+    if (!slab || slab->cache != cache)
+        return; // Oops it's not our object
+
+    // A full slab gets a free object, move it back to the partial list
+    if (!slab->free) {
+        kmem_slab_list_remove(&cache->full, slab);
+        kmem_slab_list_insert(&cache->partial, slab);
+    }
+
+    *(void **) object = slab->free;
+    slab->free = object;
+    slab->inuse--;
+    cache->total_inuse--;
+
+    // Give empty slabs back to the heap, but keep one around to avoid thrashing
+    if (slab->inuse == 0 && (slab->next || slab->prev))
+        kmem_slab_free(cache, slab);
+}
+
+/* Free an object without knowing its cache */
+void kmem_free(void *object)
+{
+    struct kmem_slab *slab = kmem_object_to_slab(object);
+
+    if (slab)
+        kmem_cache_free(slab->cache, object);
+}
+
+int kmem_cache_get_stats(int index, struct kmem_cache_stat *stat)
+{
+    struct kmem_cache *cache = kmem_caches;
+    uint32_t object_blocks;
+
+    for (int i = 0; i < index && cache; i++)
+        cache = cache->next;
+
+    if (index < 0 || !cache)
+        return -EINVARG;
+
+    memset(stat, 0, sizeof(struct kmem_cache_stat));
+    strncpy(stat->name, cache->name, sizeof(stat->name) - 1);
+    stat->object_size = cache->object_size;
+    stat->objects_inuse = cache->total_inuse;
+    stat->objects_total = cache->total_slabs * cache->objects_per_slab;
+    stat->slabs = cache->total_slabs;
+
+    // Without the cache every object would take at least one heap block
+    object_blocks = (cache->object_size + PEACHOS_HEAP_BLOCK_SIZE - 1) / PEACHOS_HEAP_BLOCK_SIZE;
+    stat->bytes_saved = (cache->total_inuse * object_blocks * PEACHOS_HEAP_BLOCK_SIZE) -
+                        (cache->total_slabs * cache->slab_size);
+
+    return 0;
+}
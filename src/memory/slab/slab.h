@@ -0,0 +1,75 @@
+/*
+ * Slab allocator header
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KMEM_CACHE_NAME_SIZE 20
+#define KMEM_SLAB_MAGIC 0x51AB51AB
+
+// Called on every object handed out by kmem_cache_alloc()
+typedef void (*KMEM_CACHE_CONSTRUCTOR)(void *object);
+
+/*
+ * A slab is a run of heap blocks. This header sits at the beginning of the
+ * first block and the objects fill the rest of the run, so an object never
+ * starts at the beginning of a heap allocation.
+ */
+struct kmem_slab {
+    uint32_t magic;
+    struct kmem_cache *cache;
+
+    // Singly linked list of free objects, the link is kept in the object itself
+    void *free;
+
+    uint32_t inuse;
+
+    struct kmem_slab *next;
+    struct kmem_slab *prev;
+};
+
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_SIZE];
+    size_t object_size;
+    size_t slab_size;
+    uint32_t objects_per_slab;
+    KMEM_CACHE_CONSTRUCTOR constructor;
+
+    // Slabs that still have free objects
+    struct kmem_slab *partial;
+
+    // Slabs without free objects
+    struct kmem_slab *full;
+
+    uint32_t total_slabs;
+    uint32_t total_inuse;
+
+    // Next cache in the list of all caches
+    struct kmem_cache *next;
+};
+
+struct kmem_cache_stat {
+    char name[KMEM_CACHE_NAME_SIZE];
+    uint32_t object_size;
+    uint32_t objects_inuse;
+    uint32_t objects_total;
+    uint32_t slabs;
+
+    // Bytes saved compared to giving each object its own heap block
+    int32_t bytes_saved;
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, KMEM_CACHE_CONSTRUCTOR constructor);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void *kmem_cache_zalloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+void kmem_free(void *object);
+int kmem_cache_get_stats(int index, struct kmem_cache_stat *stat);
+
+#endif // SLAB_H
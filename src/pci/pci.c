@@ -0,0 +1,89 @@
+/*
+ * PCI configuration space, access mechanism #1
+ *
+ * https://wiki.osdev.org/PCI
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#include <stdbool.h>
+
+#include "pci.h"
+#include "io/io.h"
+#include "status.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_MAX_BUSES 256
+#define PCI_MAX_SLOTS 32
+#define PCI_MAX_FUNCTIONS 8
+
+static uint32_t pci_config_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+    return 0x80000000 | (bus << 16) | (slot << 11) | (function << 8) | (offset & 0xFC);
+}
+
+static uint32_t pci_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, slot, function, offset));
+    return insl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_config_read(struct pci_device *device, uint8_t offset)
+{
+    return pci_read(device->bus, device->slot, device->function, offset);
+}
+
+void pci_config_write(struct pci_device *device, uint8_t offset, uint32_t val)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(device->bus, device->slot, device->function, offset));
+    outl(PCI_CONFIG_DATA, val);
+}
+
+static bool pci_device_match(uint8_t bus, uint8_t slot, uint8_t function,
+                             uint8_t class, uint8_t subclass, struct pci_device *device_out)
+{
+    uint32_t id = pci_read(bus, slot, function, PCI_VENDOR_ID);
+    uint32_t class_reg;
+
+    // No device
+    if ((id & 0xFFFF) == 0xFFFF)
+        return false;
+
+    class_reg = pci_read(bus, slot, function, PCI_CLASS);
+    if ((class_reg >> 24) != class || ((class_reg >> 16) & 0xFF) != subclass)
+        return false;
+
+    device_out->bus = bus;
+    device_out->slot = slot;
+    device_out->function = function;
+    device_out->vendor_id = id & 0xFFFF;
+    device_out->device_id = id >> 16;
+    device_out->class = class;
+    device_out->subclass = subclass;
+    device_out->prog_if = (class_reg >> 8) & 0xFF;
+
+    return true;
+}
+
+/* Find the first device of the given class, brute force scan of all the buses */
+int pci_find_device(uint8_t class, uint8_t subclass, struct pci_device *device_out)
+{
+    for (int bus = 0; bus < PCI_MAX_BUSES; bus++) {
+        for (int slot = 0; slot < PCI_MAX_SLOTS; slot++) {
+            if ((pci_read(bus, slot, 0, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF)
+                continue;
+
+            // Bit 7 of the header type, the device has several functions
+            int functions = (pci_read(bus, slot, 0, PCI_HEADER_TYPE) & 0x00800000) ? PCI_MAX_FUNCTIONS : 1;
+
+            for (int function = 0; function < functions; function++) {
+                if (pci_device_match(bus, slot, function, class, subclass, device_out))
+                    return 0;
+            }
+        }
+    }
+
+    return -EIO;
+}
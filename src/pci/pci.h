@@ -0,0 +1,42 @@
+/*
+ * PCI configuration space
+ *
+ * Author: Claudio Carvalho <claudiodecarvalho@gmail.com>
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// Configuration space registers
+#define PCI_VENDOR_ID 0x00
+#define PCI_COMMAND 0x04
+#define PCI_CLASS 0x08
+#define PCI_HEADER_TYPE 0x0C
+#define PCI_BAR4 0x20
+
+#define PCI_COMMAND_IO_SPACE 0x01
+#define PCI_COMMAND_BUS_MASTER 0x04
+
+#define PCI_CLASS_MASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+
+    uint16_t vendor_id;
+    uint16_t device_id;
+
+    uint8_t class;
+    uint8_t subclass;
+    uint8_t prog_if;
+};
+
+uint32_t pci_config_read(struct pci_device *device, uint8_t offset);
+void pci_config_write(struct pci_device *device, uint8_t offset, uint32_t val);
+int pci_find_device(uint8_t class, uint8_t subclass, struct pci_device *device_out);
+
+#endif // PCI_H
@@ -17,5 +17,6 @@
 #define EUNIMP 7
 #define EISTKN 8
 #define EINFORMAT 9
+#define EFAULT 10
 
 #endif // STATUS_H
\ No newline at end of file
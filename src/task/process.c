@@ -11,7 +11,9 @@
 #include "memory/memory.h"
 #include "task/task.h"
 #include "memory/heap/kheap.h"
+#include "memory/frame/frame.h"
 #include "fs/file.h"
+#include "fs/io_ring.h"
 #include "string/string.h"
 #include "memory/paging/paging.h"
 #include "loader/formats/elfloader.h"
@@ -61,7 +63,8 @@ void *process_malloc(struct process *process, size_t size)
     void *ptr;
     int index;
     
-    ptr = kzalloc(size);
+    // The memory gets mapped to the process, it comes in whole page frames
+    ptr = frame_zalloc(frame_count(size));
     if (!ptr)
         goto out_err;
 
@@ -83,7 +86,7 @@ void *process_malloc(struct process *process, size_t size)
 
 out_err:
     if (ptr)
-        kfree(ptr);
+        frame_free(ptr, frame_count(size));
     return NULL;
 }
 
@@ -116,7 +119,7 @@ static int process_terminate_allocations(struct process *process)
 
 int process_free_binary_data(struct process *process)
 {
-    kfree(process->ptr);
+    frame_free(process->ptr, frame_count(process->size));
     return 0;
 }
 
@@ -176,8 +179,10 @@ int process_terminate(struct process *process)
     if (res < 0)
         goto out;
 
+    io_ring_release(process);
+
     // Free the process stack memory
-    kfree(process->stack);
+    frame_free(process->stack, frame_count(PEACHOS_USER_PROGRAM_STACK_SIZE));
 
     task_free(process->task);
     process_unlink(process);
@@ -249,6 +254,8 @@ void process_free(struct process *process, void *ptr)
     struct process_allocation* allocation = process_get_allocation_by_addr(process, ptr);
     if (!allocation)
         return; // Oops it's not our pointer
+
+    size_t size = allocation->size;
     
     // Remap the task pages dropping all flags
     int res = paging_map_to(process->task->page_directory,
@@ -263,7 +270,7 @@ void process_free(struct process *process, void *ptr)
     process_allocation_unjoin(process, ptr);
 
     // Finally free the memory
-    kfree(ptr);
+    frame_free(ptr, frame_count(size));
 }
 
 static int process_load_binary(const char *filename, struct process *process)
@@ -280,7 +287,7 @@ static int process_load_binary(const char *filename, struct process *process)
     if (res != PEACHOS_ALL_OK)
         goto err_close;
 
-    program_data_ptr = kzalloc(stat.filesize);
+    program_data_ptr = frame_zalloc(frame_count(stat.filesize));
     if (!program_data_ptr) {
         res = -ENOMEM;
         goto err_close;
@@ -298,7 +305,7 @@ static int process_load_binary(const char *filename, struct process *process)
     return 0;
     
 err_free:
-    kfree(program_data_ptr);
+    frame_free(program_data_ptr, frame_count(stat.filesize));
 err_close:
     fclose(fd);
     return res;
@@ -441,7 +448,7 @@ int process_load_for_slot(const char *filename, struct process **process, int pr
     if (res < 0)
         goto out;
 
-    program_stack_ptr = kzalloc(PEACHOS_USER_PROGRAM_STACK_SIZE);
+    program_stack_ptr = frame_zalloc(frame_count(PEACHOS_USER_PROGRAM_STACK_SIZE));
     if (!program_stack_ptr) {
         res = -ENOMEM;
         goto out;
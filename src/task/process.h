@@ -17,6 +17,8 @@
 #define PROCESS_FILE_TYPE_BINARY 1
 typedef unsigned char PROCESS_FILE_TYPE;
 
+struct io_ring;
+
 struct process_allocation {
     void *ptr;
     size_t size;
@@ -66,6 +68,12 @@ struct process {
 
     // The arguments of the process
     struct process_arguments arguments;
+
+    // I/O ring shared with the program, NULL until it's set up
+    struct io_ring *io_ring;
+
+    // Files opened through the I/O ring, 0 for a free slot
+    int files[PEACHOS_MAX_PROCESS_FILES];
 };
 
 int process_switch(struct process *process);
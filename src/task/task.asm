@@ -8,6 +8,8 @@ section .asm
 global restore_general_purpose_registers
 global task_return
 global user_registers
+global task_context_switch
+global task_idle
 
 ; void task_return(struct registers *regs)
 ;
@@ -78,4 +80,33 @@ user_registers:
     mov es, ax
     mov fs, ax
     mov gs, ax
-    ret
\ No newline at end of file
+    ret
+
+; void task_context_switch(uint32_t *save_esp, uint32_t esp)
+;
+; Save the kernel context of the running task on its stack and continue on
+; the one saved at esp. The context is the callee saved registers and the
+; return address.
+task_context_switch:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov eax, [esp+20]   ; save_esp
+    mov [eax], esp
+    mov esp, [esp+24]   ; esp
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; void task_idle(void)
+;
+; Wait for the next interrupt, sti only takes effect after hlt so the
+; interrupt can't be missed
+task_idle:
+    sti
+    hlt
+    cli
+    ret
@@ -10,6 +10,7 @@
 #include "process.h"
 #include "memory/memory.h"
 #include "memory/heap/kheap.h"
+#include "memory/frame/frame.h"
 #include "memory/paging/paging.h"
 #include "idt/idt.h"
 #include "string/string.h"
@@ -22,6 +23,16 @@ struct task *current_task = NULL;
 struct task *task_tail = NULL;
 struct task *task_head = NULL;
 
+// Tasks can sleep in the kernel once the first task runs, not during the boot
+static bool task_scheduling = false;
+
+// Exited task still running on its kernel stack and page directory, see task_reap()
+static struct task *task_exited = NULL;
+
+// From assembly
+void task_context_switch(uint32_t *save_esp, uint32_t esp);
+void task_idle(void);
+
 struct task *task_current(void)
 {
     return current_task;
@@ -40,6 +51,9 @@ static void task_list_remove(struct task *task)
     if (task->prev)
         task->prev->next = task->next;
 
+    if (task->next)
+        task->next->prev = task->prev;
+
     if (task == task_head)
         task_head = task->next;
 
@@ -50,12 +64,46 @@ static void task_list_remove(struct task *task)
         current_task = task_get_next();
 }
 
+static void task_release(struct task *task)
+{
+    if (task->page_directory)
+        paging_free_4gb(task->page_directory);
+
+    if (task->kernel_stack)
+        frame_free(task->kernel_stack, frame_count(PEACHOS_TASK_KERNEL_STACK_SIZE));
+
+    kfree(task);
+}
+
+/* Free the task that exited, called once we run on the kernel stack of another task */
+static void task_reap(void)
+{
+    struct task *task = task_exited;
+
+    if (!task)
+        return;
+
+    task_exited = NULL;
+    task_release(task);
+}
+
+/*
+ * The current task is still running on its kernel stack and page directory
+ * until the switch to the next task, so it is only freed by task_reap().
+ */
 int task_free(struct task *task)
 {
-    paging_free_4gb(task->page_directory);
+    bool running = task == current_task;
+
     task_list_remove(task);
-    // Finally free the task data
-    kfree(task);
+
+    if (running) {
+        task_reap();
+        task_exited = task;
+        return 0;
+    }
+
+    task_release(task);
     return 0;
 }
 
@@ -63,12 +111,17 @@ int task_init(struct task *task, struct process *process)
 {
     memset(task, 0, sizeof(struct task));
 
-    // Map the entire 4GB address space to its self (read-only)
-    task->page_directory = paging_new_4gb(PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL);
+    // Map the entire 4GB address space to its self (read-only), sharing the kernel page tables
+    task->page_directory = paging_new_4gb_shared(kernel_paging_chunk(),
+                                                 PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL);
 
     if (!task->page_directory)
         return -EIO;
 
+    task->kernel_stack = frame_alloc(frame_count(PEACHOS_TASK_KERNEL_STACK_SIZE));
+    if (!task->kernel_stack)
+        return -ENOMEM;
+
     if (process->filetype == PROCESS_FILE_TYPE_ELF)
         task->registers.ip = elf_header(process->elf_file)->e_entry;
     else
@@ -114,56 +167,243 @@ err_free_mem:
     return NULL;
 }
 
-void task_next()
+/* Next runnable task after the current one, the current one being the last choice */
+static struct task *task_find_runnable(void)
 {
-    struct task *next_task = task_get_next();
-    if (!next_task)
+    struct task *start = (current_task && current_task->next) ? current_task->next : task_head;
+    struct task *task = start;
+
+    if (!task)
         panic("No more tasks\n");
-    
+
+    do {
+        if (task->state == TASK_STATE_RUNNABLE)
+            return task;
+        task = task->next ? task->next : task_head;
+    } while (task != start);
+
+    return NULL;
+}
+
+/* Wait with the interrupts enabled until a task is woken up */
+static struct task *task_wait_runnable(void)
+{
+    struct task *task;
+
+    while (!(task = task_find_runnable()))
+        task_idle();
+
+    return task;
+}
+
+static void task_resume_user_land(void)
+{
+    task_reap();
+    task_return(&current_task->registers);
+}
+
+/*
+ * Kernel stack pointer to switch to for resuming the task: either where it
+ * went to sleep, or a fresh stack returning to its user registers.
+ */
+static uint32_t task_resume_esp(struct task *task)
+{
+    uint32_t esp = task->kernel_esp;
+    uint32_t *stack;
+
+    if (esp) {
+        task->kernel_esp = 0;
+        return esp;
+    }
+
+    // Popped by task_context_switch: edi, esi, ebx, ebp and the return address
+    stack = (uint32_t *) (task->kernel_stack + PEACHOS_TASK_KERNEL_STACK_SIZE) - 6;
+    memset(stack, 0, sizeof(uint32_t) * 6);
+    stack[4] = (uint32_t) task_resume_user_land;
+
+    return (uint32_t) stack;
+}
+
+void task_next()
+{
+    struct task *next_task = task_wait_runnable();
+    uint32_t discarded_esp;
+
+    // The state of the current task, if any, is in its registers already
     task_switch(next_task);
-    task_return(&next_task->registers);
+    task_context_switch(&discarded_esp, task_resume_esp(next_task));
     // We won't return
 }
 
+bool task_can_sleep(void)
+{
+    return task_scheduling && current_task;
+}
+
+/*
+ * Put the current task to sleep until task_wake_up() is called on the queue.
+ * It must be called with the interrupts disabled, i.e. from a syscall,
+ * otherwise the wake up could be missed.
+ */
+void task_sleep_on(struct task_wait_queue *queue)
+{
+    struct task *task = current_task;
+    struct task *next_task;
+
+    task->state = TASK_STATE_SLEEPING;
+    task->wait_next = queue->head;
+    queue->head = task;
+
+    next_task = task_wait_runnable();
+    if (next_task == task)
+        return; // Woken up while idle
+
+    task_switch(next_task);
+    task_context_switch(&task->kernel_esp, task_resume_esp(next_task));
+    // Resumed by another task, see task_next() and task_sleep_on()
+    task_reap();
+}
+
+/* Make all the tasks of the queue runnable, it can be called from an interrupt */
+void task_wake_up(struct task_wait_queue *queue)
+{
+    struct task *task = queue->head;
+
+    while (task) {
+        struct task *next = task->wait_next;
+        task->state = TASK_STATE_RUNNABLE;
+        task->wait_next = NULL;
+        task = next;
+    }
+
+    queue->head = NULL;
+}
+
+void task_lock(struct task_lock *lock)
+{
+    while (lock->locked && task_can_sleep())
+        task_sleep_on(&lock->waiters);
+
+    lock->locked = true;
+}
+
+void task_unlock(struct task_lock *lock)
+{
+    lock->locked = false;
+    task_wake_up(&lock->waiters);
+}
+
 int task_switch(struct task *task)
 {
     current_task = task;
+    kernel_set_stack(task->kernel_stack + PEACHOS_TASK_KERNEL_STACK_SIZE);
     paging_switch(task->page_directory);
     return 0;
 }
 
-int copy_string_from_task(struct task *task, void *virtual, void *phys, int max)
+/*
+ * Physical address of the user virtual address, if the page was mapped for the
+ * process, i.e. its code, stack, I/O ring or one of its allocations. The rest
+ * of the identity map, the kernel image, the heap and the frames of the other
+ * processes, is rejected even where the CPU would let user mode access it.
+ */
+static void *task_user_address_to_physical(struct task *task, const void *user_addr, bool write)
 {
-    uint32_t *task_directory;
-    uint32_t old_entry;
-    char *tmp;
-    int res = 0;
+    uint32_t required = PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL | PAGING_IS_PRIVATE;
+    uint32_t flags;
 
-    if (max == PAGING_PAGE_SIZE)
-        return -EINVARG;
+    if (write)
+        required |= PAGING_IS_WRITEABLE;
 
-    tmp = kzalloc(max);
-    if (!tmp)
-        return -ENOMEM;
-    
-    task_directory = task->page_directory->directory_entry;
-    old_entry = paging_get(task_directory, tmp);
-    paging_map(task->page_directory, tmp, tmp, PAGING_IS_WRITEABLE | PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL);
-    paging_switch(task->page_directory);
-    strncpy(tmp, virtual, max);
-    kernel_page();
+    flags = paging_get_flags(task->page_directory->directory_entry, (void *) user_addr);
+    if ((flags & required) != required)
+        return NULL;
+
+    return task_virtual_address_to_physical(task, (void *) user_addr);
+}
+
+/* Bytes from the address up to the end of its page */
+static size_t task_page_remaining(const void *addr)
+{
+    return PAGING_PAGE_SIZE - ((uint32_t) addr % PAGING_PAGE_SIZE);
+}
 
-    res = paging_set(task_directory, tmp, old_entry);
-    if (res < 0) {
-        res = -EIO;
-        goto out_free;
+/*
+ * The user memory is copied one page at a time through its identity mapped
+ * physical address, it works whatever the page directory loaded is.
+ */
+int copy_from_user(struct task *task, void *dst, const void *user_src, size_t size)
+{
+    while (size > 0) {
+        size_t len = task_page_remaining(user_src);
+        void *phys = task_user_address_to_physical(task, user_src, false);
+
+        if (!phys)
+            return -EFAULT;
+
+        if (len > size)
+            len = size;
+
+        memcpy(dst, phys, len);
+        dst += len;
+        user_src += len;
+        size -= len;
     }
 
-    strncpy(phys, tmp, max);
+    return 0;
+}
 
-out_free:
-    kfree(tmp);
-    return res;
+int copy_to_user(struct task *task, void *user_dst, const void *src, size_t size)
+{
+    while (size > 0) {
+        size_t len = task_page_remaining(user_dst);
+        void *phys = task_user_address_to_physical(task, user_dst, true);
+
+        if (!phys)
+            return -EFAULT;
+
+        if (len > size)
+            len = size;
+
+        memcpy(phys, (void *) src, len);
+        user_dst += len;
+        src += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+/* Copy a string of up to max - 1 characters, dst is always null terminated */
+int strncpy_from_user(struct task *task, char *dst, const void *user_src, size_t max)
+{
+    size_t copied = 0;
+
+    if (max == 0)
+        return -EINVARG;
+
+    while (copied < max - 1) {
+        size_t len = task_page_remaining(user_src);
+        const char *phys = task_user_address_to_physical(task, user_src, false);
+
+        if (!phys)
+            return -EFAULT;
+
+        if (len > max - 1 - copied)
+            len = max - 1 - copied;
+
+        for (size_t i = 0; i < len; i++) {
+            dst[copied] = phys[i];
+            if (phys[i] == 0x00)
+                return 0;
+            copied++;
+        }
+
+        user_src += len;
+    }
+
+    dst[copied] = 0x00;
+    return 0;
 }
 
 void task_save_state(struct task *task, struct interrupt_frame *frame)
@@ -213,24 +453,20 @@ void task_run_first_ever_task(void)
     if (!current_task)
         panic("task_run_first_ever_task(): No current task exists!\n");
 
+    task_scheduling = true;
     task_switch(task_head);
     task_return(&task_head->registers);
 }
 
 void *task_get_stack_item(struct task *task, int index)
 {
-    void *result = 0;
     uint32_t *sp_ptr = (uint32_t *) task->registers.esp;
+    uint32_t item;
 
-    // Switch to the given task page
-    task_page_task(task);
-
-    result = (void *) sp_ptr[index];
-
-    // Switch back to the kernel page
-    kernel_page();
+    if (copy_from_user(task, &item, &sp_ptr[index], sizeof(item)) < 0)
+        return 0;
 
-    return result;
+    return (void *) item;
 }
 
 void *task_virtual_address_to_physical(struct task *task, void *virtual_address)
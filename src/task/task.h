@@ -30,6 +30,11 @@ struct registers {
 
 struct process;
 
+// The task can be picked by the scheduler
+#define TASK_STATE_RUNNABLE 0
+// The task is waiting in the kernel on a wait queue
+#define TASK_STATE_SLEEPING 1
+
 struct task {
     // The page directory of the task
     struct paging_4gb_chunk *page_directory;
@@ -37,6 +42,18 @@ struct task {
     // The registers of the task when it is not running
     struct registers registers;
 
+    // Kernel stack used by the interrupts and syscalls of the task
+    void *kernel_stack;
+
+    // Saved kernel stack pointer while the task sleeps in the kernel, 0 when
+    // the task gets resumed from its user registers
+    uint32_t kernel_esp;
+
+    uint32_t state;
+
+    // The next task in the same wait queue
+    struct task *wait_next;
+
     // The process of the task
     struct process *process;
 
@@ -47,6 +64,16 @@ struct task {
     struct task *prev;
 };
 
+struct task_wait_queue {
+    struct task *head;
+};
+
+// Sleeping lock, the owner can wait in the kernel while holding it
+struct task_lock {
+    bool locked;
+    struct task_wait_queue waiters;
+};
+
 struct task *task_new(struct process *process);
 struct task *task_current(void);
 struct task *task_get_next(void);
@@ -61,10 +88,18 @@ void restore_general_purpose_registers(struct registers *regs);
 void user_registers(void);
 
 void task_current_save_state(struct interrupt_frame *frame);
-int copy_string_from_task(struct task *task, void *virtual, void *phys, int max);
+int copy_from_user(struct task *task, void *dst, const void *user_src, size_t size);
+int copy_to_user(struct task *task, void *user_dst, const void *src, size_t size);
+int strncpy_from_user(struct task *task, char *dst, const void *user_src, size_t max);
 void *task_get_stack_item(struct task *task, int index);
 int task_page_task(struct task *task);
 void *task_virtual_address_to_physical(struct task *task, void *virtual_address);
 void task_next();
 
+bool task_can_sleep(void);
+void task_sleep_on(struct task_wait_queue *queue);
+void task_wake_up(struct task_wait_queue *queue);
+void task_lock(struct task_lock *lock);
+void task_unlock(struct task_lock *lock);
+
 #endif // TASK_H
\ No newline at end of file